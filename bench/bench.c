@@ -0,0 +1,549 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include <video/framebuffer_display.h>
+#include <input/null_input.h>
+
+#include "gameboy.h"
+#include "frame_pacer.h"
+#include "logging.h"
+
+/*
+ * Runs fixed workloads headless for a number of frames and reports how fast
+ * the emulator is. The synthetic roms are assembled below and written to
+ * temporary files, since the game boy loads games from files.
+ */
+
+void die(const char *s) {
+  fputs(s, stderr);
+  abort();
+}
+
+#define ROM_BANK_SIZE 0x4000
+#define MAX_ROM_SIZE (512 * ROM_BANK_SIZE)
+
+typedef struct workload {
+  const char *name;
+  const char *description;
+  /* assembles the rom and returns its size, NULL for cpu_instrs */
+  size_t (*build_rom)(uint8_t *rom);
+} workload_t;
+
+typedef struct result {
+  uint32_t frames;
+  uint64_t cycles;
+  uint64_t instructions;
+  /* the fastest run, in nanoseconds */
+  int64_t duration;
+} result_t;
+
+/*
+ * Writes the entry point and the header every rom needs.
+ * .type        The cartridge type, e.g. 0 for rom only, 1 for MBC1.
+ * .banks       The number of 16 KiB rom banks, a power of two >= 2.
+ */
+static size_t write_header(uint8_t *rom, uint8_t type, size_t banks) {
+  /* NOP; JP 0x0150 */
+  static const uint8_t entry[] = {0x00, 0xC3, 0x50, 0x01};
+  memcpy(rom + 0x100, entry, sizeof(entry));
+  memcpy(rom + 0x134, "MAGE BENCH", 10);
+
+  uint8_t rom_size = 0;
+  while ((2u << rom_size) < banks) ++rom_size;
+
+  rom[0x147] = type;
+  rom[0x148] = rom_size;
+  rom[0x149] = 0;
+  return banks * ROM_BANK_SIZE;
+}
+
+/* ALU, loads and stores, the stack, calls and CB instructions in a loop */
+static size_t build_instruction_mix(uint8_t *rom) {
+  static const uint8_t main[] = {
+      0x31, 0xFE, 0xDF,   /* 0150  LD SP, 0xDFFE */
+      0x21, 0x00, 0xC0,   /* 0153  LD HL, 0xC000 */
+      0x06, 0x40,         /* 0156  LD B, 0x40      ; outer */
+      0x78,               /* 0158  LD A, B         ; inner */
+      0x87,               /* 0159  ADD A, A */
+      0xAB,               /* 015A  XOR E */
+      0x5F,               /* 015B  LD E, A */
+      0x22,               /* 015C  LD (HL+), A */
+      0x7E,               /* 015D  LD A, (HL) */
+      0x82,               /* 015E  ADD A, D */
+      0x57,               /* 015F  LD D, A */
+      0xD5,               /* 0160  PUSH DE */
+      0xCB, 0x13,         /* 0161  RL E */
+      0xCB, 0x3A,         /* 0163  SRL D */
+      0xCD, 0x00, 0x02,   /* 0165  CALL 0x0200 */
+      0xD1,               /* 0168  POP DE */
+      0x13,               /* 0169  INC DE */
+      0x05,               /* 016A  DEC B */
+      0x20, 0xEB,         /* 016B  JR NZ, inner */
+      0x7C,               /* 016D  LD A, H */
+      0xFE, 0xCF,         /* 016E  CP 0xCF */
+      0x38, 0xE4,         /* 0170  JR C, outer */
+      0x21, 0x00, 0xC0,   /* 0172  LD HL, 0xC000 */
+      0x18, 0xDF,         /* 0175  JR outer */
+  };
+  static const uint8_t subroutine[] = {
+      0xE5,               /* 0200  PUSH HL */
+      0x21, 0x00, 0xD0,   /* 0201  LD HL, 0xD000 */
+      0x7B,               /* 0204  LD A, E */
+      0x86,               /* 0205  ADD A, (HL) */
+      0x77,               /* 0206  LD (HL), A */
+      0x29,               /* 0207  ADD HL, HL */
+      0xE1,               /* 0208  POP HL */
+      0xC9,               /* 0209  RET */
+  };
+
+  memcpy(rom + 0x150, main, sizeof(main));
+  memcpy(rom + 0x200, subroutine, sizeof(subroutine));
+  return write_header(rom, 0x00, 2);
+}
+
+/*
+ * Background, window and 40 sprites of 8x16 pixels. The cpu mostly halts,
+ * every line scrolls the background and every frame changes a tile.
+ */
+static size_t build_ppu_scene(uint8_t *rom) {
+  static const uint8_t main[] = {
+      0x31, 0xFE, 0xDF,   /* 0150  LD SP, 0xDFFE */
+      0xF3,               /* 0153  DI */
+      0x21, 0x00, 0x80,   /* 0154  LD HL, 0x8000 */
+      0x7D,               /* 0157  LD A, L         ; tiles */
+      0xAC,               /* 0158  XOR H */
+      0x22,               /* 0159  LD (HL+), A */
+      0x7C,               /* 015A  LD A, H */
+      0xFE, 0x98,         /* 015B  CP 0x98 */
+      0x20, 0xF8,         /* 015D  JR NZ, tiles */
+      0x7D,               /* 015F  LD A, L         ; maps */
+      0x22,               /* 0160  LD (HL+), A */
+      0x7C,               /* 0161  LD A, H */
+      0xFE, 0xA0,         /* 0162  CP 0xA0 */
+      0x20, 0xF9,         /* 0164  JR NZ, maps */
+      0x21, 0x00, 0xFE,   /* 0166  LD HL, 0xFE00 */
+      0x06, 0x28,         /* 0169  LD B, 40 */
+      0x78,               /* 016B  LD A, B         ; sprites */
+      0x87,               /* 016C  ADD A, A */
+      0xC6, 0x10,         /* 016D  ADD A, 0x10 */
+      0x22,               /* 016F  LD (HL+), A     ; y */
+      0x87,               /* 0170  ADD A, A */
+      0x22,               /* 0171  LD (HL+), A     ; x */
+      0x78,               /* 0172  LD A, B */
+      0x22,               /* 0173  LD (HL+), A     ; tile */
+      0xCB, 0x37,         /* 0174  SWAP A */
+      0x22,               /* 0176  LD (HL+), A     ; attributes */
+      0x05,               /* 0177  DEC B */
+      0x20, 0xF1,         /* 0178  JR NZ, sprites */
+      0x3E, 0xE4,         /* 017A  LD A, 0xE4 */
+      0xE0, 0x47,         /* 017C  LDH (BGP), A */
+      0x3E, 0xD2,         /* 017E  LD A, 0xD2 */
+      0xE0, 0x48,         /* 0180  LDH (OBP0), A */
+      0x3E, 0x1B,         /* 0182  LD A, 0x1B */
+      0xE0, 0x49,         /* 0184  LDH (OBP1), A */
+      0x3E, 0x40,         /* 0186  LD A, 0x40 */
+      0xE0, 0x4A,         /* 0188  LDH (WY), A */
+      0x3E, 0x50,         /* 018A  LD A, 0x50 */
+      0xE0, 0x4B,         /* 018C  LDH (WX), A */
+      0x3E, 0x08,         /* 018E  LD A, 0x08 */
+      0xE0, 0x41,         /* 0190  LDH (STAT), A   ; h-blank interrupt */
+      0x3E, 0x03,         /* 0192  LD A, 0x03 */
+      0xE0, 0xFF,         /* 0194  LDH (IE), A */
+      0x3E, 0xF7,         /* 0196  LD A, 0xF7 */
+      0xE0, 0x40,         /* 0198  LDH (LCDC), A */
+      0xAF,               /* 019A  XOR A */
+      0xE0, 0x0F,         /* 019B  LDH (IF), A */
+      0xFB,               /* 019D  EI */
+      0x76,               /* 019E  HALT            ; idle */
+      0x18, 0xFD,         /* 019F  JR idle */
+  };
+  static const uint8_t v_blank[] = {
+      0xF5,               /* 0210  PUSH AF */
+      0xE5,               /* 0211  PUSH HL */
+      0xF0, 0x42,         /* 0212  LDH A, (SCY) */
+      0x3C,               /* 0214  INC A */
+      0xE0, 0x42,         /* 0215  LDH (SCY), A */
+      0x21, 0x10, 0x80,   /* 0217  LD HL, 0x8010 */
+      0x34,               /* 021A  INC (HL) */
+      0x21, 0x01, 0xFE,   /* 021B  LD HL, 0xFE01 */
+      0x34,               /* 021E  INC (HL) */
+      0xE1,               /* 021F  POP HL */
+      0xF1,               /* 0220  POP AF */
+      0xD9,               /* 0221  RETI */
+  };
+  static const uint8_t h_blank[] = {
+      0xF5,               /* 0230  PUSH AF */
+      0xF0, 0x43,         /* 0231  LDH A, (SCX) */
+      0x3C,               /* 0233  INC A */
+      0xE0, 0x43,         /* 0234  LDH (SCX), A */
+      0xF1,               /* 0236  POP AF */
+      0xD9,               /* 0237  RETI */
+  };
+  /* JP 0x0210 and JP 0x0230 */
+  static const uint8_t vectors[][3] = {{0xC3, 0x10, 0x02},
+                                       {0xC3, 0x30, 0x02}};
+
+  memcpy(rom + 0x40, vectors[0], sizeof(vectors[0]));
+  memcpy(rom + 0x48, vectors[1], sizeof(vectors[1]));
+  memcpy(rom + 0x150, main, sizeof(main));
+  memcpy(rom + 0x210, v_blank, sizeof(v_blank));
+  memcpy(rom + 0x230, h_blank, sizeof(h_blank));
+  return write_header(rom, 0x00, 2);
+}
+
+/* An MBC1 rom of 16 banks that switches the bank before every read. */
+static size_t build_bank_switch_storm(uint8_t *rom) {
+  static const uint8_t main[] = {
+      0x31, 0xFE, 0xDF,   /* 0150  LD SP, 0xDFFE */
+      0x06, 0x01,         /* 0153  LD B, 1 */
+      0xAF,               /* 0155  XOR A           ; switch */
+      0xEA, 0x00, 0x40,   /* 0156  LD (0x4000), A  ; upper bank bits */
+      0x78,               /* 0159  LD A, B */
+      0xEA, 0x00, 0x20,   /* 015A  LD (0x2000), A  ; lower bank bits */
+      0xFA, 0x00, 0x40,   /* 015D  LD A, (0x4000) */
+      0x21, 0x01, 0x40,   /* 0160  LD HL, 0x4001 */
+      0x86,               /* 0163  ADD A, (HL) */
+      0xEA, 0x00, 0xC0,   /* 0164  LD (0xC000), A */
+      0x04,               /* 0167  INC B */
+      0x78,               /* 0168  LD A, B */
+      0xE6, 0x0F,         /* 0169  AND 0x0F */
+      0x20, 0xE8,         /* 016B  JR NZ, switch */
+      0x06, 0x01,         /* 016D  LD B, 1 */
+      0x18, 0xE4,         /* 016F  JR switch */
+  };
+
+  memcpy(rom + 0x150, main, sizeof(main));
+
+  /* every bank starts with its number */
+  for (int bank = 1; bank < 16; ++bank) {
+    rom[bank * ROM_BANK_SIZE] = (uint8_t) bank;
+    rom[bank * ROM_BANK_SIZE + 1] = (uint8_t) (bank << 4);
+  }
+
+  return write_header(rom, 0x01, 16);
+}
+
+/* Every bank starts with LD A, (0x4010); RET and has its number at 0x10. */
+static void write_bank_routines(uint8_t *rom, int banks) {
+  static const uint8_t routine[] = {0xFA, 0x10, 0x40, 0xC9};
+  for (int bank = 1; bank < banks; ++bank) {
+    memcpy(rom + bank * ROM_BANK_SIZE, routine, sizeof(routine));
+    rom[bank * ROM_BANK_SIZE + 0x10] = (uint8_t) bank;
+  }
+}
+
+/*
+ * An MBC5 rom of 512 banks (8 MiB) that calls into every bank in turn,
+ * setting both the lower 8 bits and the 9th bit of the bank number.
+ */
+static size_t build_mbc5_bank_switch(uint8_t *rom) {
+  static const uint8_t main[] = {
+      0x31, 0xFE, 0xDF,   /* 0150  LD SP, 0xDFFE */
+      0x01, 0x00, 0x00,   /* 0153  LD BC, 0        ; restart */
+      0x78,               /* 0156  LD A, B         ; switch */
+      0xEA, 0x00, 0x30,   /* 0157  LD (0x3000), A  ; 9th bank bit */
+      0x79,               /* 015A  LD A, C */
+      0xEA, 0x00, 0x20,   /* 015B  LD (0x2000), A  ; lower bank bits */
+      0xCD, 0x00, 0x40,   /* 015E  CALL 0x4000 */
+      0xEA, 0x00, 0xC0,   /* 0161  LD (0xC000), A */
+      0x03,               /* 0164  INC BC */
+      0x78,               /* 0165  LD A, B */
+      0xFE, 0x02,         /* 0166  CP 2 */
+      0x20, 0xEC,         /* 0168  JR NZ, switch */
+      0x18, 0xE7,         /* 016A  JR restart */
+  };
+
+  memcpy(rom + 0x150, main, sizeof(main));
+  /* mbc5 can map bank 0 too, the routine then runs from 0x0000 */
+  write_bank_routines(rom, 512);
+  memcpy(rom, rom + ROM_BANK_SIZE, 4);
+
+  return write_header(rom, 0x19, 512);
+}
+
+/*
+ * An MBC2 rom of 16 banks that calls into every bank in turn and stores
+ * the result in the built-in ram.
+ */
+static size_t build_mbc2_bank_switch(uint8_t *rom) {
+  static const uint8_t main[] = {
+      0x31, 0xFE, 0xDF,   /* 0150  LD SP, 0xDFFE */
+      0x3E, 0x0A,         /* 0153  LD A, 0x0A */
+      0xEA, 0x00, 0x00,   /* 0155  LD (0x0000), A  ; enable the ram */
+      0x06, 0x01,         /* 0158  LD B, 1         ; restart */
+      0x78,               /* 015A  LD A, B         ; switch */
+      0xEA, 0x00, 0x21,   /* 015B  LD (0x2100), A  ; rom bank */
+      0xCD, 0x00, 0x40,   /* 015E  CALL 0x4000 */
+      0xEA, 0x00, 0xA0,   /* 0161  LD (0xA000), A */
+      0x04,               /* 0164  INC B */
+      0x78,               /* 0165  LD A, B */
+      0xE6, 0x0F,         /* 0166  AND 0x0F */
+      0x20, 0xF0,         /* 0168  JR NZ, switch */
+      0x18, 0xEC,         /* 016A  JR restart */
+  };
+
+  memcpy(rom + 0x150, main, sizeof(main));
+  write_bank_routines(rom, 16);
+
+  return write_header(rom, 0x05, 16);
+}
+
+static const workload_t workloads[] = {
+    {"cpu_instrs", "the blargg cpu instruction tests", 0},
+    {"instruction_mix", "synthetic mix of common instructions",
+     build_instruction_mix},
+    {"ppu_scene", "background, window and sprites with scrolling",
+     build_ppu_scene},
+    {"bank_switch", "MBC1 rom bank switch before every read",
+     build_bank_switch_storm},
+    {"mbc5_bank_switch", "MBC5 calls into all of 512 rom banks",
+     build_mbc5_bank_switch},
+    {"mbc2_bank_switch", "MBC2 calls into 16 rom banks, writes its ram",
+     build_mbc2_bank_switch},
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static struct {
+  const char *cpu_instrs;
+  const char *workload;
+  uint32_t frames;
+  uint32_t runs;
+  bool json;
+  bool memory_timing;
+} set_options;
+
+static struct option options[] = {
+    {"help",       no_argument,       0, 'h'},
+    {"frames",     required_argument, 0, 'F'},
+    {"runs",       required_argument, 0, 'r'},
+    {"workload",   required_argument, 0, 'w'},
+    {"cpu-instrs", required_argument, 0, 'c'},
+    {"json",       no_argument,       0, 'j'},
+    {"accurate",   no_argument,       0, 'a'},
+    {NULL, 0, NULL,                 0},
+};
+
+static const char *option_string = "hF:r:w:c:ja";
+
+static void usage(const char *program_name) {
+  fprintf(stderr, "Usage: %s [OPTIONS]\n", program_name);
+  fprintf(stderr, "Available Options:\n");
+  fprintf(stderr, "\t-h,--help             Display this message.\n");
+  fprintf(stderr, "\t-F,--frames N         Run every workload for N frames "
+                  "(default 600).\n");
+  fprintf(stderr, "\t-r,--runs N           Report the fastest of N runs "
+                  "(default 3).\n");
+  fprintf(stderr, "\t-w,--workload NAME    Run only this workload.\n");
+  fprintf(stderr, "\t-c,--cpu-instrs FILE  The rom of the cpu_instrs "
+                  "workload.\n");
+  fprintf(stderr, "\t-j,--json             Print the results as JSON.\n");
+  fprintf(stderr, "\t-a,--accurate         Time every memory access "
+                  "exactly (slower).\n");
+  fprintf(stderr, "Workloads:\n");
+  for (size_t i = 0; i < NUM_WORKLOADS; ++i)
+    fprintf(stderr, "\t%-22s%s\n", workloads[i].name,
+            workloads[i].description);
+}
+
+static int setup_options(int argc, char *argv[]) {
+  set_options.cpu_instrs = BENCH_CPU_INSTRS;
+  set_options.frames = 600;
+  set_options.runs = 3;
+
+  int flg;
+  while ((flg = getopt_long(argc, argv, option_string, options, 0)) != -1) {
+    switch (flg) {
+      case 'h':
+        usage(argv[0]);
+        exit(0);
+      case 'F':
+        set_options.frames = (uint32_t) strtoul(optarg, 0, 10);
+        break;
+      case 'r':
+        set_options.runs = (uint32_t) strtoul(optarg, 0, 10);
+        break;
+      case 'w':
+        set_options.workload = optarg;
+        break;
+      case 'c':
+        set_options.cpu_instrs = optarg;
+        break;
+      case 'j':
+        set_options.json = true;
+        break;
+      case 'a':
+        set_options.memory_timing = true;
+        break;
+      default:
+        return 1;
+    }
+  }
+
+  if (!set_options.frames || !set_options.runs) return 1;
+
+  return 0;
+}
+
+/* Writes the rom to a new temporary file, 'path' receives its name. */
+static bool write_rom(const workload_t *workload, char *path) {
+  uint8_t *rom = 0;
+  FILE *file = 0;
+
+  strcpy(path, "/tmp/mage-bench-XXXXXX");
+  int fd = mkstemp(path);
+  if (fd < 0) goto fail;
+
+  file = fdopen(fd, "wb");
+  if (!file) {
+    close(fd);
+    goto fail;
+  }
+
+  rom = calloc(1, MAX_ROM_SIZE);
+  if (!rom) goto fail;
+
+  size_t size = workload->build_rom(rom);
+  if (fwrite(rom, 1, size, file) != size) goto fail;
+  if (fclose(file)) {
+    file = 0;
+    goto fail;
+  }
+
+  free(rom);
+  return true;
+
+fail:
+  logging_std_error();
+  free(rom);
+  if (file) fclose(file);
+  if (fd >= 0) unlink(path);
+  return false;
+}
+
+/*
+ * Runs the rom on a new game boy that draws into memory, so the ppu does
+ * its full work. Returns false if the game boy could not be created.
+ */
+static bool run_once(const char *rom_path, result_t *result) {
+  static uint8_t pixels[FRAMEBUFFER_SIZE];
+
+  display_t *display = framebuffer_display_new(pixels);
+  input_strategy_t *joy_pad = null_joy_pad_new();
+  if (!display || !joy_pad) return false;
+
+  gb_t gb = game_boy_new(0, display, joy_pad);
+  if (!gb) return false;
+
+  game_boy_insert_game(gb, rom_path, 0);
+  game_boy_set_memory_timing(gb, set_options.memory_timing);
+
+  uint64_t cycles = game_boy_cycles(gb);
+  uint64_t instructions = game_boy_instructions(gb);
+
+  int64_t start = frame_pacer_now();
+  game_boy_run_frames(gb, set_options.frames);
+  int64_t duration = frame_pacer_now() - start;
+
+  result->frames = set_options.frames;
+  result->cycles = game_boy_cycles(gb) - cycles;
+  result->instructions = game_boy_instructions(gb) - instructions;
+  if (!result->duration || duration < result->duration)
+    result->duration = duration;
+
+  game_boy_delete(gb);
+  display->delete(display);
+  return true;
+}
+
+static bool run_workload(const workload_t *workload, result_t *result) {
+  char path[32];
+  const char *rom_path = set_options.cpu_instrs;
+
+  if (workload->build_rom) {
+    if (!write_rom(workload, path)) return false;
+    rom_path = path;
+  } else if (access(rom_path, R_OK)) {
+    perror(rom_path);
+    return false;
+  }
+
+  bool success = true;
+  for (uint32_t run = 0; success && run < set_options.runs; ++run)
+    success = run_once(rom_path, result);
+
+  if (workload->build_rom)
+    unlink(path);
+  return success;
+}
+
+static void print_result(const workload_t *workload, const result_t *result,
+                         bool first) {
+  double seconds = result->duration / 1e9;
+  double cycles_per_second = result->cycles / seconds;
+  double frames_per_second = result->frames / seconds;
+  double ns_per_instruction =
+      (double) result->duration / result->instructions;
+
+  if (!set_options.json) {
+    printf("%-16s %8.1f fps %9.2f MHz (%6.1fx) %7.2f ns/instruction\n",
+           workload->name, frames_per_second, cycles_per_second / 1e6,
+           cycles_per_second / CLOCK_SPEED, ns_per_instruction);
+    return;
+  }
+
+  printf("%s\n    {\"name\": \"%s\", \"frames\": %u, \"cycles\": %llu, "
+         "\"instructions\": %llu, \"seconds\": %.6f, "
+         "\"cycles_per_second\": %.0f, \"frames_per_second\": %.2f, "
+         "\"ns_per_instruction\": %.3f, \"speed\": %.3f}",
+         first ? "" : ",", workload->name, result->frames,
+         (unsigned long long) result->cycles,
+         (unsigned long long) result->instructions, seconds,
+         cycles_per_second, frames_per_second, ns_per_instruction,
+         cycles_per_second / CLOCK_SPEED);
+}
+
+int main(int argc, char *argv[]) {
+  logging_initialize();
+
+  if (setup_options(argc, argv)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (set_options.json)
+    printf("{\n  \"frames\": %u,\n  \"runs\": %u,\n  \"accurate\": %s,\n"
+           "  \"workloads\": [", set_options.frames, set_options.runs,
+           set_options.memory_timing ? "true" : "false");
+
+  bool first = true;
+  int status = 0;
+  for (size_t i = 0; i < NUM_WORKLOADS; ++i) {
+    const workload_t *workload = &workloads[i];
+    if (set_options.workload && strcmp(set_options.workload, workload->name))
+      continue;
+
+    result_t result = {0};
+    if (!run_workload(workload, &result)) {
+      fprintf(stderr, "Workload %s failed.\n", workload->name);
+      status = 1;
+      continue;
+    }
+
+    print_result(workload, &result, first);
+    first = false;
+  }
+
+  if (set_options.json)
+    printf("\n  ]\n}\n");
+
+  if (first) {
+    logging_error("No workload was run.");
+    return 1;
+  }
+
+  return status;
+}
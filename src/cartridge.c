@@ -4,50 +4,158 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #import "cartridge.h"
 #include "logging.h"
+#include "save_state.h"
+#include "rom_cache.h"
+#include "frame_pacer.h"
 
 void die(const char *s);
 
 typedef struct save_game save_game_t;
 
+/*
+ * The ram is written to the save file by a thread of its own, so the
+ * emulation never waits for the disk. The game boy hands over a copy of
+ * the ram once the game stopped writing it, see cartridge_end_frame.
+ * If the save file is mapped as the ram, the thread only syncs the mapping.
+ */
 typedef struct save_game {
   const char *file_name;
   void (*save)(save_game_t *);
   void (*load)(save_game_t *);
 
   cartridge_t *cart;
+
+  /* the content of the save file */
+  size_t size;
+  /* the save file mapped as the ram, followed by the clock, or NULL */
+  uint8_t *mapping;
+  /* the size of the file before it was mapped */
+  size_t mapped_file_size;
+  /* frames between syncs of the mapping, 0 syncs only on deletion */
+  uint32_t sync_frames;
+  /* filled by the emulation, swapped with 'writing' by the thread */
+  uint8_t *pending;
+  uint8_t *writing;
+  bool has_pending;
+  bool stop;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+
+  /* frames since the last write to the ram and since the oldest write
+   * that is not saved yet */
+  uint32_t quiet_frames;
+  uint32_t unsaved_frames;
+  bool unsaved;
 } save_game_t;
 
+/* save after this many frames without writes to the ram (one second) */
+#define SAVE_QUIET_FRAMES 60
+/* but at least every ten seconds while the game keeps writing */
+#define SAVE_MAX_UNSAVED_FRAMES 600
+
 static void save_game_load(save_game_t *this);
 
 static void save_game_save(save_game_t *this);
 
+static void save_game_load_mapped(save_game_t *this);
+
+static void save_game_sync_mapped(save_game_t *this);
+
+static bool save_game_map(save_game_t *this, const save_policy_t *policy);
+
+static void save_game_unmap(save_game_t *this);
+
 static void save_game_nop(save_game_t *this) {}
 
-save_game_t *save_game_new(const char *file_name, cartridge_t *cart) {
+static void *save_game_writer(void *context);
+
+static size_t save_game_size(cartridge_t *cart);
+
+/*
+ * .policy      How the save file is kept, may be NULL, see save_policy_t.
+ *              If the file can not be mapped, it is written as a copy.
+ */
+save_game_t *save_game_new(const char *file_name, cartridge_t *cart,
+                           const save_policy_t *policy) {
   save_game_t *sg = calloc(1, sizeof(save_game_t));
   if (!sg) return 0;
 
   sg->cart = cart;
 
+  /* without ram or a clock there is nothing to save */
+  sg->size = save_game_size(cart);
+  if (!file_name || !sg->size) {
+    sg->save = save_game_nop;
+    sg->load = save_game_nop;
+    return sg;
+  }
+
   sg->file_name = file_name;
-  if (file_name) {
+  if (policy && policy->mapped && save_game_map(sg, policy)) {
+    sg->save = save_game_sync_mapped;
+    sg->load = save_game_load_mapped;
+  }
+  else {
     sg->save = save_game_save;
     sg->load = save_game_load;
+    sg->pending = malloc(sg->size);
+    sg->writing = malloc(sg->size);
+    if (!sg->pending || !sg->writing) goto fail;
   }
-  else {
-    sg->save = save_game_nop;
-    sg->load = save_game_nop;
+
+  pthread_mutex_init(&sg->lock, 0);
+  pthread_cond_init(&sg->wake, 0);
+  if (pthread_create(&sg->thread, 0, save_game_writer, sg)) {
+    pthread_cond_destroy(&sg->wake);
+    pthread_mutex_destroy(&sg->lock);
+    goto fail;
   }
 
   return sg;
+
+fail:
+  logging_std_error();
+  save_game_unmap(sg);
+  free(sg->pending);
+  free(sg->writing);
+  free(sg);
+  return 0;
 }
 
 void save_game_delete(save_game_t *this) {
+  if (!this) return;
+
   /* save upon deletion */
   this->save(this);
+
+  /* only games with something to save have a file and a thread */
+  if (this->file_name) {
+    /* the thread writes what is pending before it stops */
+    pthread_mutex_lock(&this->lock);
+    this->stop = true;
+    pthread_cond_signal(&this->wake);
+    pthread_mutex_unlock(&this->lock);
+    pthread_join(this->thread, 0);
+
+    pthread_cond_destroy(&this->wake);
+    pthread_mutex_destroy(&this->lock);
+    free(this->pending);
+    free(this->writing);
+  }
+
+  save_game_unmap(this);
   free(this);
 }
 
@@ -63,20 +171,55 @@ typedef struct __attribute__((packed)) cartridge_header_t {
   uint8_t ___[6];
 } cartridge_header_t;
 
+/* seconds, minutes, hours, lower 8 bits of the day, upper bit and flags */
+#define RTC_REGISTERS 5
+#define RTC_DAY_HIGH 4
+#define RTC_HALT 0x40
+#define RTC_DAY_CARRY 0x80
+
+/* the real time clock of the mbc3, counting emulated time */
+typedef struct rtc {
+  uint8_t registers[RTC_REGISTERS];
+  /* what the game reads, a copy of the registers made by a latch */
+  uint8_t latched[RTC_REGISTERS];
+  /* the clock is latched by writing 0x00 and then 0x01 to 0x6000 */
+  uint8_t latch_value;
+  /* the cycles of the current second that already passed */
+  uint32_t cycles;
+  /* brought up to date lazily, see rtc_sync */
+  uint64_t last_sync;
+} rtc_t;
+
 typedef struct cartridge_mem_handler_t {
   mem_handler_t base;
   cartridge_t *cart;
 } cartridge_mem_handler_t;
 
 typedef struct cartridge_t {
-  cartridge_header_t *header;
+  const cartridge_header_t *header;
   const char *game_file_name;
   save_game_t *save_game;
 
-  uint8_t *rom_memory;
+  /* shared with other cartridges of the same game, read only */
+  const uint8_t *rom_memory;
+  size_t rom_size;
   uint8_t *ram_memory;
+  /* the bytes of ram kept in the save game */
+  size_t ram_size;
 
-  uint8_t selected_rom_bank;
+  enum {
+    NO_MBC, MBC1, MBC2, MBC3, MBC5
+  } controller;
+  /* the ram bank register of rumble carts also drives the motor */
+  bool rumble;
+  bool has_rtc;
+  rtc_t rtc;
+  /* the ram or the clock was written since the last frame */
+  bool ram_written;
+  /* the cycles the game boy ran, the rtc does not tick without them */
+  const uint64_t *clock;
+
+  uint16_t selected_rom_bank;
   uint8_t selected_ram_bank;
 
   bool ram_enabled;
@@ -84,15 +227,32 @@ typedef struct cartridge_t {
     ROM_MODE, RAM_MODE
   } mode;
 
+  /* the banks mapped to 0x4000 - 0x7FFF and 0xA000 - 0xBFFF, updated when
+   * a bank register is written; the ram window is NULL while disabled */
+  const uint8_t *rom_window;
+  uint8_t *ram_window;
+  bank_switch_t bank_switch_listener;
+  void *bank_switch_context;
+
   cartridge_mem_handler_t internal_mem_handler;
 } cartridge_t;
 
-static size_t cartridge_calculate_ram_size(uint8_t ram_size);
+static void mbc2_mirror_ram(cartridge_t *cart);
+
+static void rtc_load(cartridge_t *cart, const uint8_t *buffer, size_t size);
+
+static void rtc_save(cartridge_t *cart, uint8_t *buffer);
+
+/* the clock follows the ram in the save file */
+#define RTC_SAVE_SIZE 48
 
 #define get_rom_size(cart)  (1 << ((cart)->header->rom_size + 1))
 #define upper_bank_no(cart) (uint8_t) ((cart)->selected_rom_bank & 0xE0)
 #define lower_bank_no(cart) (uint8_t) ((cart)->selected_rom_bank & 0x1F)
 
+/* the 512 half bytes of the mbc2, repeated all over 0xA000 - 0xBFFF */
+#define MBC2_RAM_SIZE 0x200
+
 static void save_game_load(save_game_t *this) {
   FILE *file = fopen(this->file_name, "r");
   if (!file) {
@@ -101,33 +261,234 @@ static void save_game_load(save_game_t *this) {
   }
 
   cartridge_t *cart = this->cart;
-  size_t size = cartridge_calculate_ram_size(cart->header->ram_size);
-  fread(cart->ram_memory, size, 1, file);
+  fread(cart->ram_memory, cart->ram_size, 1, file);
+  if (cart->controller == MBC2)
+    mbc2_mirror_ram(cart);
+  if (cart->has_rtc) {
+    uint8_t buffer[RTC_SAVE_SIZE];
+    rtc_load(cart, buffer, fread(buffer, 1, sizeof(buffer), file));
+  }
 
   fclose(file);
 }
 
-static void save_game_save(save_game_t *this) {
-  FILE *file = fopen(this->file_name, "w");
-  if (!file) {
-    logging_warning("Save game could not be loaded");
-    return;
+/*
+ * Maps the save file as the ram of the cartridge, so writes to the ram
+ * reach the file through the page cache without any copies. The file is
+ * extended to the size of a save if it is shorter. Only possible for whole
+ * ram banks, the mbc2 and small rams keep a copy.
+ */
+static bool save_game_map(save_game_t *this, const save_policy_t *policy) {
+  cartridge_t *cart = this->cart;
+  if (cart->controller == MBC2 || cart->ram_size < 0x2000) {
+    logging_warning("The ram of this cartridge can not be mapped.");
+    return false;
   }
 
-  logging_message("Saving game.");
+  int fd = open(this->file_name, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) goto fail;
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat)) goto fail;
+  this->mapped_file_size = (size_t) file_stat.st_size;
+
+  if (this->mapped_file_size < this->size &&
+      ftruncate(fd, (off_t) this->size))
+    goto fail;
+
+  void *mapping = mmap(0, this->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+  if (mapping == MAP_FAILED) goto fail;
+  close(fd);
+
+  /* the ram is mapped instead */
+  free(cart->ram_memory);
+  cart->ram_memory = mapping;
+  this->mapping = mapping;
+  this->sync_frames = policy->sync_interval * 60;
+  return true;
 
+fail:
+  logging_std_error();
+  if (fd >= 0) close(fd);
+  logging_warning("The save file could not be mapped, it is written instead.");
+  return false;
+}
+
+/* the cartridge must not free the mapped ram */
+static void save_game_unmap(save_game_t *this) {
+  if (!this->mapping)
+    return;
+
+  munmap(this->mapping, this->size);
+  this->cart->ram_memory = 0;
+  this->mapping = 0;
+}
+
+/* The ram is the file already, only the clock is left. */
+static void save_game_load_mapped(save_game_t *this) {
   cartridge_t *cart = this->cart;
-  size_t size = cartridge_calculate_ram_size(cart->header->ram_size);
-  fwrite(cart->ram_memory, size, 1, file);
+  if (!cart->has_rtc || this->mapped_file_size <= cart->ram_size)
+    return;
 
-  fclose(file);
+  size_t size = this->mapped_file_size - cart->ram_size;
+  rtc_load(cart, this->mapping + cart->ram_size,
+           size < RTC_SAVE_SIZE ? size : RTC_SAVE_SIZE);
+}
+
+/* Stores the clock behind the ram and lets the thread sync the file. */
+static void save_game_sync_mapped(save_game_t *this) {
+  cartridge_t *cart = this->cart;
+  if (cart->has_rtc)
+    rtc_save(cart, this->mapping + cart->ram_size);
+
+  pthread_mutex_lock(&this->lock);
+  this->has_pending = true;
+  pthread_cond_signal(&this->wake);
+  pthread_mutex_unlock(&this->lock);
 }
 
-static uint8_t *cartridge_ram_access(cartridge_t *cart, gb_address_t address) {
-  assert(cart->selected_ram_bank < 4);
-  uint8_t used_ram_bank = cart->mode ? cart->selected_ram_bank : (uint8_t) 0;
-  uint8_t *ram_bank = cart->ram_memory + used_ram_bank * 0x2000;
-  return ram_bank + (address & ~(0xE000));
+static size_t save_game_size(cartridge_t *cart) {
+  return cart->ram_size + (cart->has_rtc ? RTC_SAVE_SIZE : 0);
+}
+
+/* Hands a copy of the ram to the thread, which writes it later. */
+static void save_game_save(save_game_t *this) {
+  cartridge_t *cart = this->cart;
+
+  pthread_mutex_lock(&this->lock);
+  memcpy(this->pending, cart->ram_memory, cart->ram_size);
+  if (cart->has_rtc)
+    rtc_save(cart, this->pending + cart->ram_size);
+  this->has_pending = true;
+  pthread_cond_signal(&this->wake);
+  pthread_mutex_unlock(&this->lock);
+}
+
+/* Returns the directory of the file, "." if it has none. */
+static char *directory_of(const char *file_name) {
+  const char *slash = strrchr(file_name, '/');
+  if (!slash)
+    return strdup(".");
+  if (slash == file_name)
+    return strdup("/");
+  return strndup(file_name, (size_t) (slash - file_name));
+}
+
+/*
+ * Replaces the file so that a crash leaves either the old or the new
+ * content: the data goes to a temporary file, which is synced and then
+ * renamed over the file. Returns false if the file could not be written.
+ */
+static bool write_file_atomically(const char *file_name, const uint8_t *data,
+                                  size_t size) {
+  bool success = false;
+  char *temp_name = malloc(strlen(file_name) + 5);
+  char *directory = directory_of(file_name);
+  int fd = -1;
+  if (!temp_name || !directory) goto out;
+
+  sprintf(temp_name, "%s.tmp", file_name);
+  fd = open(temp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) goto out;
+
+  while (size) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0 && errno == EINTR) continue;
+    if (written < 0) goto out;
+    data += written;
+    size -= (size_t) written;
+  }
+
+  if (fsync(fd)) goto out;
+  if (close(fd)) {
+    fd = -1;
+    goto out;
+  }
+  fd = -1;
+
+  if (rename(temp_name, file_name)) goto out;
+
+  /* make the rename itself durable */
+  int directory_fd = open(directory, O_RDONLY);
+  if (directory_fd >= 0) {
+    fsync(directory_fd);
+    close(directory_fd);
+  }
+  success = true;
+
+out:
+  if (fd >= 0) {
+    close(fd);
+    unlink(temp_name);
+  }
+  free(temp_name);
+  free(directory);
+  return success;
+}
+
+/* Writes the copies of the ram, or syncs the mapping, until it is told to
+ * stop. */
+static void *save_game_writer(void *context) {
+  save_game_t *this = (save_game_t *) context;
+
+  pthread_mutex_lock(&this->lock);
+  for (;;) {
+    while (!this->has_pending && !this->stop)
+      pthread_cond_wait(&this->wake, &this->lock);
+    if (!this->has_pending)
+      break;
+
+    uint8_t *data = this->pending;
+    this->pending = this->writing;
+    this->writing = data;
+    this->has_pending = false;
+    pthread_mutex_unlock(&this->lock);
+
+    logging_message("Saving game.");
+    if (this->mapping) {
+      if (msync(this->mapping, this->size, MS_SYNC))
+        logging_std_error();
+    }
+    else if (!write_file_atomically(this->file_name, data, this->size)) {
+      logging_std_error();
+    }
+
+    pthread_mutex_lock(&this->lock);
+  }
+  pthread_mutex_unlock(&this->lock);
+
+  return 0;
+}
+
+/* The mbc3 maps a register of the clock instead of a ram bank. */
+static bool rtc_selected(const cartridge_t *cart) {
+  return cart->has_rtc && cart->selected_ram_bank >= 0x08;
+}
+
+static uint8_t rtc_read(cartridge_t *cart);
+
+/* Points the windows at the selected banks and tells the listener. */
+static void update_windows(cartridge_t *cart) {
+  /* banks beyond the end of the file wrap around */
+  size_t rom_banks = cart->rom_size / 0x4000;
+  const uint8_t *rom_window =
+      cart->rom_memory + (cart->selected_rom_bank % rom_banks) * 0x4000;
+
+  uint8_t *ram_window = 0;
+  if (cart->ram_enabled && cart->ram_memory && !rtc_selected(cart)) {
+    size_t ram_banks = cart->ram_size > 0x2000 ? cart->ram_size / 0x2000 : 1;
+    ram_window =
+        cart->ram_memory + (cart->selected_ram_bank % ram_banks) * 0x2000;
+  }
+
+  if (rom_window == cart->rom_window && ram_window == cart->ram_window)
+    return;
+
+  cart->rom_window = rom_window;
+  cart->ram_window = ram_window;
+  if (cart->bank_switch_listener)
+    cart->bank_switch_listener(cart->bank_switch_context);
 }
 
 static DEF_MEM_READ(cartridge_read) {
@@ -136,19 +497,18 @@ static DEF_MEM_READ(cartridge_read) {
   switch (address & 0xE000) {
     case 0x0000:
     case 0x2000:
-      return *(cart->rom_memory + address);
+      return cart->rom_memory[address];
 
     case 0x4000:
     case 0x6000:
-      return *(cart->rom_memory + (cart->selected_rom_bank - 1) * 0x4000 +
-               address);
-
-    case 0xA000: {
-      uint8_t value = 0xFF;
-      if (cart->ram_enabled)
-        value = (*cartridge_ram_access(cart, address));
-      return value;
-    }
+      return cart->rom_window[address - 0x4000];
+
+    case 0xA000:
+      if (cart->ram_window)
+        return cart->ram_window[address - 0xA000];
+      if (cart->ram_enabled && rtc_selected(cart))
+        return rtc_read(cart);
+      return 0xFF;
 
     default:
       die("Illegal address");
@@ -159,14 +519,13 @@ static DEF_MEM_READ(cartridge_read) {
 
 /* Memory Bank Controller 1 */
 
+/* banks beyond the ram of the cartridge wrap around, see update_windows */
 static void select_ram_bank(cartridge_t *cart, uint8_t bank_no) {
-  static uint8_t max_banks[] = {0, 0, 0, 3, 15};
-  uint8_t max_bank_no = max_banks[cart->header->ram_size];
-  cart->selected_ram_bank = bank_no > max_bank_no ? max_bank_no : bank_no;
+  cart->selected_ram_bank = bank_no;
 }
 
-static void select_rom_bank(cartridge_t *cart, uint8_t bank_no) {
-  uint8_t mask = (uint8_t) (get_rom_size(cart) - 1);
+static void select_rom_bank(cartridge_t *cart, uint16_t bank_no) {
+  uint16_t mask = (uint16_t) (get_rom_size(cart) - 1);
   cart->selected_rom_bank = bank_no & mask;
 }
 
@@ -212,19 +571,139 @@ static DEF_MEM_WRITE(cartridge_mbc1_write) {
         cart->selected_rom_bank = lower_bank_no(cart);
       break;
 
-    case 0xA000: {
-      if (cart->ram_enabled)
-        *cartridge_ram_access(cart, address) = value;
-      break;
-    }
+    case 0xA000:
+      if (cart->ram_window) {
+        cart->ram_window[address - 0xA000] = value;
+        cart->ram_written = true;
+      }
+      return;
 
     default:
       die("Illegal address");
   }
+
+  update_windows(cart);
 }
 
 /* Memory Bank Controller 3 */
 
+/*
+ * Adds the seconds to the clock. The counters wrap like the real ones,
+ * after 511 days the day carry is set until the game clears it.
+ */
+static void rtc_advance(rtc_t *rtc, uint64_t seconds) {
+  uint8_t *regs = rtc->registers;
+  if (!seconds || (regs[RTC_DAY_HIGH] & RTC_HALT))
+    return;
+
+  uint64_t carry = regs[0] + seconds;
+  regs[0] = (uint8_t) (carry % 60);
+  carry = carry / 60 + regs[1];
+  regs[1] = (uint8_t) (carry % 60);
+  carry = carry / 60 + regs[2];
+  regs[2] = (uint8_t) (carry % 24);
+
+  uint64_t day = carry / 24 + regs[3] + ((regs[RTC_DAY_HIGH] & 1) << 8);
+  uint8_t flags = regs[RTC_DAY_HIGH] & (RTC_HALT | RTC_DAY_CARRY);
+  if (day > 0x1FF)
+    flags |= RTC_DAY_CARRY;
+  regs[3] = (uint8_t) day;
+  regs[RTC_DAY_HIGH] = (uint8_t) (flags | ((day >> 8) & 1));
+}
+
+/* Advances the clock by the emulated time passed since the last sync. */
+static void rtc_sync(cartridge_t *cart) {
+  rtc_t *rtc = &cart->rtc;
+  if (!cart->clock)
+    return;
+
+  uint64_t cycles = *cart->clock - rtc->last_sync;
+  rtc->last_sync = *cart->clock;
+  if (rtc->registers[RTC_DAY_HIGH] & RTC_HALT)
+    return;
+
+  cycles += rtc->cycles;
+  rtc->cycles = (uint32_t) (cycles % CLOCK_SPEED);
+  rtc_advance(rtc, cycles / CLOCK_SPEED);
+}
+
+static uint8_t rtc_read(cartridge_t *cart) {
+  uint8_t reg = (uint8_t) (cart->selected_ram_bank - 0x08);
+  return reg < RTC_REGISTERS ? cart->rtc.latched[reg] : 0xFF;
+}
+
+static void rtc_write(cartridge_t *cart, uint8_t value) {
+  static const uint8_t masks[RTC_REGISTERS] = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+
+  uint8_t reg = (uint8_t) (cart->selected_ram_bank - 0x08);
+  if (reg >= RTC_REGISTERS)
+    return;
+
+  rtc_sync(cart);
+  cart->rtc.registers[reg] = value & masks[reg];
+  /* writing the seconds restarts the current second */
+  if (reg == 0)
+    cart->rtc.cycles = 0;
+}
+
+static void rtc_latch(cartridge_t *cart, uint8_t value) {
+  rtc_t *rtc = &cart->rtc;
+  if (rtc->latch_value == 0x00 && value == 0x01) {
+    rtc_sync(cart);
+    memcpy(rtc->latched, rtc->registers, RTC_REGISTERS);
+  }
+  rtc->latch_value = value;
+}
+
+static uint32_t read_le32(const uint8_t *bytes) {
+  return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
+
+static void write_le32(uint8_t *bytes, uint64_t value) {
+  for (int i = 0; i < 4; ++i)
+    bytes[i] = (uint8_t) (value >> (8 * i));
+}
+
+/*
+ * The clock follows the ram in the save game, in the layout most emulators
+ * use: the registers and the latched registers as 32 bit numbers and the
+ * time of saving, all little endian. Older saves end with a 32 bit time.
+ */
+static void rtc_load(cartridge_t *cart, const uint8_t *buffer, size_t size) {
+  if (size != 44 && size != 48)
+    return;
+
+  rtc_t *rtc = &cart->rtc;
+  for (int i = 0; i < RTC_REGISTERS; ++i) {
+    rtc->registers[i] = (uint8_t) read_le32(buffer + 4 * i);
+    rtc->latched[i] = (uint8_t) read_le32(buffer + 20 + 4 * i);
+  }
+
+  int64_t saved = read_le32(buffer + 40);
+  if (size == 48)
+    saved |= (int64_t) read_le32(buffer + 44) << 32;
+
+  /* catch up with the time the game was not running */
+  int64_t elapsed = (int64_t) time(NULL) - saved;
+  if (elapsed > 0)
+    rtc_advance(rtc, (uint64_t) elapsed);
+}
+
+/* Writes RTC_SAVE_SIZE bytes to the buffer. */
+static void rtc_save(cartridge_t *cart, uint8_t *buffer) {
+  rtc_t *rtc = &cart->rtc;
+  rtc_sync(cart);
+
+  for (int i = 0; i < RTC_REGISTERS; ++i) {
+    write_le32(buffer + 4 * i, rtc->registers[i]);
+    write_le32(buffer + 20 + 4 * i, rtc->latched[i]);
+  }
+
+  uint64_t now = (uint64_t) time(NULL);
+  write_le32(buffer + 40, now);
+  write_le32(buffer + 44, now >> 32);
+}
+
 static DEF_MEM_WRITE(cartridge_mbc3_write) {
   cartridge_t *cart = ((cartridge_mem_handler_t *) this)->cart;
 
@@ -244,17 +723,120 @@ static DEF_MEM_WRITE(cartridge_mbc3_write) {
       break;
 
     case 0x6000:
+      if (cart->has_rtc)
+        rtc_latch(cart, value);
+      return;
+
+    case 0xA000:
+      if (cart->ram_window) {
+        cart->ram_window[address - 0xA000] = value;
+        cart->ram_written = true;
+      }
+      else if (cart->ram_enabled && rtc_selected(cart)) {
+        rtc_write(cart, value);
+        cart->ram_written = true;
+      }
+      return;
+
+    default:
+      die("Illegal address");
+  }
+
+  update_windows(cart);
+}
+
+/* Memory Bank Controller 2 */
+
+/* Only the lower half of every byte exists, the upper half reads as 1s. */
+static void mbc2_mirror_ram(cartridge_t *cart) {
+  uint8_t *ram = cart->ram_memory;
+  for (size_t i = 0; i < 0x2000; ++i)
+    ram[i] = (uint8_t) (ram[i % MBC2_RAM_SIZE] | 0xF0);
+}
+
+static DEF_MEM_WRITE(cartridge_mbc2_write) {
+  cartridge_t *cart = ((cartridge_mem_handler_t *) this)->cart;
+
+  switch (address & 0xE000) {
+    case 0x0000:
+    case 0x2000:
+      /* the lowest bit of the upper address byte selects the register */
+      if (address & 0x100) {
+        value &= 0xF;
+        if (!value) ++value;
+        select_rom_bank(cart, value);
+      }
+      else {
+        cart->ram_enabled = (value & 0xF) == 0xA;
+      }
       break;
 
-    case 0xA000: {
-      if (cart->ram_enabled)
-        *cartridge_ram_access(cart, address) = value;
+    case 0x4000:
+    case 0x6000:
+      return;
+
+    case 0xA000:
+      if (!cart->ram_window)
+        return;
+      /* the handler reads the whole window, so keep every copy current */
+      for (size_t i = address & (MBC2_RAM_SIZE - 1); i < 0x2000;
+           i += MBC2_RAM_SIZE)
+        cart->ram_memory[i] = (uint8_t) (value | 0xF0);
+      cart->ram_written = true;
+      return;
+
+    default:
+      die("Illegal address");
+  }
+
+  update_windows(cart);
+}
+
+/* Memory Bank Controller 5 */
+
+static DEF_MEM_WRITE(cartridge_mbc5_write) {
+  cartridge_t *cart = ((cartridge_mem_handler_t *) this)->cart;
+
+  switch (address & 0xF000) {
+    case 0x0000:
+    case 0x1000:
+      cart->ram_enabled = (value & 0xF) == 0xA;
       break;
-    }
+
+    /* the lower 8 bits of the rom bank, unlike mbc1 bank 0 can be selected */
+    case 0x2000:
+      select_rom_bank(cart, (uint16_t) ((cart->selected_rom_bank & 0x100) |
+                                        value));
+      break;
+
+    /* the 9th bit of the rom bank */
+    case 0x3000:
+      select_rom_bank(cart, (uint16_t) (((value & 1) << 8) |
+                                        (cart->selected_rom_bank & 0xFF)));
+      break;
+
+    case 0x4000:
+    case 0x5000:
+      select_ram_bank(cart, (uint8_t) (value & (cart->rumble ? 0x7 : 0xF)));
+      break;
+
+    case 0x6000:
+    case 0x7000:
+      return;
+
+    case 0xA000:
+    case 0xB000:
+      if (cart->ram_window) {
+        cart->ram_window[address - 0xA000] = value;
+        cart->ram_written = true;
+      }
+      return;
 
     default:
       die("Illegal address");
   }
+
+  update_windows(cart);
 }
 
 static DEF_MEM_WRITE(default_rom_write) {}
@@ -266,67 +848,59 @@ static void cartridge_mem_handler_init(cartridge_t *c) {
 
   switch (c->header->cartridge_type) {
     case 0x0:
+      c->controller = NO_MBC;
       c->internal_mem_handler.base.write = default_rom_write;
       break;
     case 0x1:
     case 0x2:
     case 0x3:
+      c->controller = MBC1;
       c->internal_mem_handler.base.write = cartridge_mbc1_write;
       break;
+    case 0x5:
+    case 0x6:
+      c->controller = MBC2;
+      c->internal_mem_handler.base.write = cartridge_mbc2_write;
+      break;
+    case 0x0F:
+    case 0x10:
+      c->has_rtc = true;
+      /* fall through */
+    case 0x11:
+    case 0x12:
     case 0x13:
+      c->controller = MBC3;
       c->internal_mem_handler.base.write = cartridge_mbc3_write;
       break;
+    case 0x1C:
+    case 0x1D:
+    case 0x1E:
+      c->rumble = true;
+      /* fall through */
+    case 0x19:
+    case 0x1A:
+    case 0x1B:
+      c->controller = MBC5;
+      c->internal_mem_handler.base.write = cartridge_mbc5_write;
+      break;
     default:
       die("Unsupported cartridge type");
   }
 }
 
-static void print_running_message(cartridge_header_t *header) {
+static void print_running_message(const cartridge_header_t *header) {
   fprintf(stderr, "Log: Running: %15s\n", header->game_title);
 }
 
-static ssize_t get_file_size(FILE *file) {
-  fseek(file, 0, SEEK_END);
-  long size = ftell(file);
+/* The size of the ram in bytes, the mbc2 brings its own. */
+static size_t cartridge_calculate_ram_size(const cartridge_t *cart) {
+  static const size_t sizes[] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
 
-  if (size < 0) {
-    return size;
-  }
-
-  fseek(file, 0, SEEK_SET);
-  return (size_t) size;
-}
-
-static uint8_t *cartridge_load_rom(const char *filename) {
-  FILE *file = 0;
-  uint8_t *memory = 0;
-
-  file = fopen(filename, "rb");
-  if (!file) goto fail;
-
-  ssize_t rom_size = get_file_size(file);
-  if (rom_size < 0) goto fail;
-
-  memory = malloc(rom_size);
-  if (!memory) goto fail;
-
-  if (fread(memory, 1, rom_size, file) != rom_size) {
-    goto fail;
-  }
-
-  fclose(file);
-
-  return memory;
-
-  fail:
-  logging_std_error();
-  free(memory);
-  if (file) fclose(file);
-  return 0;
-}
-
-static size_t cartridge_calculate_ram_size(uint8_t ram_size) {
-  return ((size_t) 1 << (ram_size * 2 - 1)) * 1024;
+  if (cart->controller == MBC2)
+    return MBC2_RAM_SIZE;
+  if (cart->header->ram_size >= sizeof(sizes) / sizeof(sizes[0]))
+    return 0;
+  return sizes[cart->header->ram_size];
 }
 
 void cartridge_delete(cartridge_t *c) {
@@ -334,56 +908,80 @@ void cartridge_delete(cartridge_t *c) {
    * so this needs to be deleted first */
   save_game_delete(c->save_game);
 
-  free(c->rom_memory);
+  rom_cache_release(c->rom_memory);
   if (c->ram_memory) free(c->ram_memory);
   free(c);
 }
 
-static uint8_t *cartridge_allocate_ram(uint8_t ram_size) {
-  return malloc(cartridge_calculate_ram_size(ram_size));
+/* at least one whole bank, so the ram window can always be mapped */
+static uint8_t *cartridge_allocate_ram(size_t ram_size) {
+  return calloc(1, ram_size < 0x2000 ? 0x2000 : ram_size);
 }
 
-cartridge_t *cartridge_new(const char *game_path, const char *save_file) {
+/*
+ * Loads the game and its save game.
+ * .save_file   May be NULL, then nothing is saved.
+ * .policy      How the save file is kept, NULL writes it in the background.
+ */
+cartridge_t *cartridge_new(const char *game_path, const char *save_file,
+                           const save_policy_t *policy) {
   cartridge_t *cart = 0;
-  uint8_t *memory = 0;
+  const uint8_t *memory = 0;
+  size_t rom_size;
 
   cart = calloc(1, sizeof(cartridge_t));
   if (!cart) goto fail;
 
-  memory = cartridge_load_rom(game_path);
+  memory = rom_cache_acquire(game_path, &rom_size);
   if (!memory) goto fail;
 
-  cartridge_header_t *header = (cartridge_header_t *) (memory + 0x100);
+  /* reading past a mapped file is fatal, there are at least two banks */
+  if (rom_size < 0x8000) {
+    logging_error("The rom is too small.");
+    goto fail;
+  }
+
+  const cartridge_header_t *header =
+      (const cartridge_header_t *) (memory + 0x100);
 
   cart->rom_memory = memory;
+  cart->rom_size = rom_size;
   cart->header = header;
   cart->selected_rom_bank = 1;
   cart->selected_ram_bank = 0;
   cart->ram_enabled = 0;
+  cart->rtc.latch_value = 0xFF;
 
-  if (header->ram_size) {
-    cart->ram_memory = cartridge_allocate_ram(header->ram_size);
+  cartridge_mem_handler_init(cart);
+
+  cart->ram_size = cartridge_calculate_ram_size(cart);
+  if (cart->ram_size) {
+    cart->ram_memory = cartridge_allocate_ram(cart->ram_size);
     if (!cart->ram_memory) goto fail;
+    if (cart->controller == MBC2)
+      mbc2_mirror_ram(cart);
   }
 
   cart->game_file_name = game_path;
 
-  cart->save_game = save_game_new(save_file, cart);
+  cart->save_game = save_game_new(save_file, cart, policy);
   if (!cart->save_game) goto fail;
 
   /* load save game into ram */
   cart->save_game->load(cart->save_game);
 
-  cartridge_mem_handler_init(cart);
+  update_windows(cart);
 
   print_running_message(header);
 
   return cart;
 
 fail:
-  free(memory);
-  if (cart)
+  rom_cache_release(memory);
+  if (cart) {
     free(cart->save_game);
+    free(cart->ram_memory);
+  }
   free(cart);
   return 0;
 }
@@ -392,4 +990,142 @@ mem_handler_t *cartridge_get_memory_handler(cartridge_t *cart) {
   return (mem_handler_t *) &cart->internal_mem_handler;
 }
 
+/* Returns the rom bank that is always mapped to 0x0000 - 0x3FFF. */
+uint8_t *cartridge_get_fixed_rom_bank(cartridge_t *cart) {
+  /* the mmu maps it for reading only */
+  return (uint8_t *) cart->rom_memory;
+}
+
+/*
+ * Returns the memory of the rom bank mapped to 0x4000 - 0x7FFF, 16 KiB
+ * that must not be changed.
+ */
+const uint8_t *cartridge_get_rom_window(cartridge_t *cart) {
+  return cart->rom_window;
+}
+
+/*
+ * Returns the memory of the ram bank mapped to 0xA000 - 0xBFFF, 8 KiB, or
+ * NULL if the ram is disabled or not present. The mbc2 ram is never mapped:
+ * a write changes all copies, but only the written address is reported to
+ * the block cache.
+ */
+uint8_t *cartridge_get_ram_window(cartridge_t *cart) {
+  if (cart->controller == MBC2)
+    return 0;
+  return cart->ram_window;
+}
+
+/*
+ * Calls the listener whenever another bank is mapped to 0x4000 - 0x7FFF
+ * or 0xA000 - 0xBFFF, e.g. to map the new windows directly.
+ */
+void cartridge_set_bank_switch_listener(cartridge_t *cart,
+                                        bank_switch_t listener,
+                                        void *context) {
+  cart->bank_switch_listener = listener;
+  cart->bank_switch_context = context;
+}
+
+/*
+ * Lets the real time clock of the cartridge, if there is one, count the
+ * cycles the game boy runs instead of the time of the host. This keeps it
+ * in step with the game at any speed.
+ * .clock       The cycles since power on, read on every access to the clock.
+ */
+void cartridge_set_clock(cartridge_t *cart, const uint64_t *clock) {
+  rtc_sync(cart);
+  cart->clock = clock;
+  cart->rtc.last_sync = clock ? *clock : 0;
+}
+
+/*
+ * Called after every frame. Once the game stopped writing the ram for a
+ * while, or has kept writing it for long, a copy is handed to the thread
+ * that writes the save file. A mapped save file is synced every
+ * sync_interval seconds while the game writes the ram.
+ */
+void cartridge_end_frame(cartridge_t *cart) {
+  save_game_t *sg = cart->save_game;
+
+  if (cart->ram_written) {
+    cart->ram_written = false;
+    if (!sg->unsaved)
+      sg->unsaved_frames = 0;
+    sg->unsaved = true;
+    sg->quiet_frames = 0;
+  } else {
+    ++sg->quiet_frames;
+  }
+
+  if (!sg->unsaved)
+    return;
+
+  ++sg->unsaved_frames;
+  bool due = sg->mapping
+      ? sg->sync_frames && sg->unsaved_frames >= sg->sync_frames
+      : sg->quiet_frames >= SAVE_QUIET_FRAMES ||
+        sg->unsaved_frames >= SAVE_MAX_UNSAVED_FRAMES;
+  if (due) {
+    sg->save(sg);
+    sg->unsaved = false;
+  }
+}
+
+/* Returns the number of the rom bank mapped to 0x4000 - 0x7FFF. */
+uint16_t cartridge_get_rom_bank(cartridge_t *cart) {
+  return cart->selected_rom_bank;
+}
+
+/* the header and global checksum tell games apart */
+static void cartridge_identity(cartridge_t *cart, uint8_t *identity) {
+  memcpy(identity, cart->header->___ + 3, 3);
+}
+
+/* Writes the bank registers, the content of the cartridge ram and the clock. */
+void cartridge_save_state(cartridge_t *cart, state_buffer_t *state) {
+  uint8_t identity[3];
+  cartridge_identity(cart, identity);
+  state_write_value(state, identity);
+
+  uint8_t registers[] = {
+      (uint8_t) cart->selected_rom_bank,
+      (uint8_t) (cart->selected_rom_bank >> 8), cart->selected_ram_bank,
+      cart->ram_enabled, (uint8_t) cart->mode
+  };
+  state_write_value(state, registers);
+  state_write(state, cart->ram_memory, cart->ram_size);
+  if (cart->has_rtc)
+    state_write_value(state, cart->rtc);
+}
+
+/*
+ * Restores the cartridge. Returns false, without changing anything, if the
+ * state belongs to another game.
+ */
+bool cartridge_load_state(cartridge_t *cart, state_buffer_t *state) {
+  uint8_t identity[3], expected[3];
+  state_read_value(state, identity);
+  cartridge_identity(cart, expected);
+  if (memcmp(identity, expected, sizeof(identity)) != 0)
+    return false;
+
+  uint8_t registers[5];
+  state_read_value(state, registers);
+  cart->selected_rom_bank = (uint16_t) (registers[0] | registers[1] << 8);
+  cart->selected_ram_bank = registers[2];
+  cart->ram_enabled = registers[3];
+  cart->mode = registers[4] ? RAM_MODE : ROM_MODE;
+
+  state_read(state, cart->ram_memory, cart->ram_size);
+  cart->ram_written = true;
+  if (cart->controller == MBC2)
+    mbc2_mirror_ram(cart);
+  /* the cycles of the last sync are restored along with the scheduler */
+  if (cart->has_rtc)
+    state_read_value(state, cart->rtc);
+  update_windows(cart);
+  return true;
+}
+
 void cartridge_delete(cartridge_t *c);
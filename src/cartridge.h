@@ -1,12 +1,45 @@
 #pragma once
 
+#include <stdbool.h>
 #include <memory/memory_handler.h>
 
 typedef struct cartridge_t cartridge_t;
+typedef struct state_buffer state_buffer_t;
 
-cartridge_t *cartridge_new(const char *game_path, const char *save_file);
+typedef void (*bank_switch_t)(void *context);
+
+/* how the save file is kept */
+typedef struct save_policy {
+  /* the save file is mapped as the cartridge ram, instead of written */
+  bool mapped;
+  /* seconds between syncs of the mapped file, 0 syncs only on exit */
+  uint32_t sync_interval;
+} save_policy_t;
+
+cartridge_t *cartridge_new(const char *game_path, const char *save_file,
+                           const save_policy_t *policy);
 
 void cartridge_delete(cartridge_t *);
 
 mem_handler_t *cartridge_get_memory_handler(cartridge_t *cart);
 
+uint8_t *cartridge_get_fixed_rom_bank(cartridge_t *cart);
+
+uint16_t cartridge_get_rom_bank(cartridge_t *cart);
+
+void cartridge_set_clock(cartridge_t *cart, const uint64_t *clock);
+
+void cartridge_end_frame(cartridge_t *cart);
+
+const uint8_t *cartridge_get_rom_window(cartridge_t *cart);
+
+uint8_t *cartridge_get_ram_window(cartridge_t *cart);
+
+void cartridge_set_bank_switch_listener(cartridge_t *cart,
+                                        bank_switch_t listener,
+                                        void *context);
+
+void cartridge_save_state(cartridge_t *cart, state_buffer_t *state);
+
+bool cartridge_load_state(cartridge_t *cart, state_buffer_t *state);
+
@@ -10,23 +10,21 @@
 
 #include <logging.h>
 
-static struct sockaddr_in server_address;
 const int server_port = 9000;
 
-static void setup_server_address(void) {
-  if (server_address.sin_port)
-    return;
-  server_address.sin_family = AF_INET;
-  server_address.sin_port = htons(server_port);
-  inet_aton("127.0.0.1", &server_address.sin_addr);
+static void setup_server_address(struct sockaddr_in *server_address) {
+  memset(server_address, 0, sizeof(*server_address));
+  server_address->sin_family = AF_INET;
+  server_address->sin_port = htons(server_port);
+  inet_aton("127.0.0.1", &server_address->sin_addr);
 }
 
-int udp_client(void) {
+int udp_client(const struct sockaddr_in *server_address) {
   int client = socket(AF_INET, SOCK_DGRAM, 0);
   if (client == -1)
     return -1;
 
-  struct sockaddr_in cli_addr = server_address;
+  struct sockaddr_in cli_addr = *server_address;
   cli_addr.sin_port = htons(0);
 
   if (bind(client, (struct sockaddr *) &cli_addr, sizeof(cli_addr)) == -1) {
@@ -37,19 +35,21 @@ int udp_client(void) {
   return client;
 }
 
-static int send_message(int client, const char *message, size_t len) {
+static int send_message(int client, const struct sockaddr_in *server_address,
+                        const char *message, size_t len) {
   int nbytes = sendto(client, message, len, 0,
-                      (struct sockaddr *) &server_address,
-                      sizeof(server_address));
+                      (const struct sockaddr *) server_address,
+                      sizeof(*server_address));
   return nbytes == -1;
 }
 
-int subscribe(int client, const char *type) {
+int subscribe(int client, const struct sockaddr_in *server_address,
+              const char *type) {
   static const char ack_message[] = "subscribe : success";
 
   char message[128];
   int num_written = snprintf(message, sizeof(message), "subscribe : %s", type);
-  if (send_message(client, message, num_written))
+  if (send_message(client, server_address, message, num_written))
     return 1;
 
   struct timeval t = {.tv_sec = 1};
@@ -75,13 +75,14 @@ int ctrl_client_new(ctrl_service_t type) {
   static const char *services[] = {
       "INPUT", "CONFIG"
   };
-  setup_server_address();
+  struct sockaddr_in server_address;
+  setup_server_address(&server_address);
 
-  int client = udp_client();
+  int client = udp_client(&server_address);
   if (client == -1)
     return -1;
 
-  if (subscribe(client, services[type]))
+  if (subscribe(client, &server_address, services[type]))
     goto fail;
 
   int flags = fcntl(client, F_GETFL);
@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory/mmu.h>
+#include "block_cache.h"
+
+const uint8_t instruction_duration[256] = {
+    4, 12, 8, 8, 4, 4, 8, 4, 20, 8, 8, 8, 4, 4, 8, 4,
+    4, 12, 8, 8, 4, 4, 8, 4, 12, 8, 8, 8, 4, 4, 8, 4,
+    12, 12, 8, 8, 4, 4, 8, 4, 12, 8, 8, 8, 4, 4, 8, 4,
+    12, 12, 8, 8, 12, 12, 12, 4, 12, 8, 8, 8, 4, 4, 8, 4,
+    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
+    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
+    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
+    8, 8, 8, 8, 8, 8, 4, 8, 4, 4, 4, 4, 4, 4, 8, 4,
+    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
+    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
+    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
+    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
+    20, 12, 16, 16, 24, 16, 8, 16, 20, 16, 16, 0, 24, 24, 8, 16,
+    20, 12, 16,  0, 24, 16, 8, 16, 20, 16, 16, 0, 24,  0, 8, 16,
+    12, 12, 8, 0, 0, 16, 8, 16, 16, 4, 16, 0, 0, 0, 8, 16,
+    12, 12, 8, 4, 0, 16, 8, 16, 12, 8, 16, 4, 0, 0, 8, 16
+};
+
+static const uint8_t instruction_lengths[256] = {
+    1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 3, 3, 3, 1, 2, 1, 1, 1, 3, 2, 3, 3, 2, 1,
+    1, 1, 3, 1, 3, 1, 2, 1, 1, 1, 3, 1, 3, 1, 2, 1,
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1,
+    2, 1, 1, 1, 1, 1, 2, 1, 2, 1, 3, 1, 1, 1, 2, 1
+};
+
+uint8_t instruction_length(uint8_t opcode) {
+  return instruction_lengths[opcode];
+}
+
+/* does the instruction (potentially) continue somewhere else than after
+ * itself? */
+static bool changes_control_flow(uint8_t opcode) {
+  switch (opcode) {
+    case 0x10: /* STOP */
+    case 0x18: /* JR */
+    case 0x20:
+    case 0x28:
+    case 0x30:
+    case 0x38:
+    case 0x76: /* HALT */
+    case 0xC0: /* RET */
+    case 0xC8:
+    case 0xC9:
+    case 0xD0:
+    case 0xD8:
+    case 0xD9:
+    case 0xC2: /* JP */
+    case 0xC3:
+    case 0xCA:
+    case 0xD2:
+    case 0xDA:
+    case 0xE9:
+    case 0xC4: /* CALL */
+    case 0xCC:
+    case 0xCD:
+    case 0xD4:
+    case 0xDC:
+    case 0xC7: /* RST */
+    case 0xCF:
+    case 0xD7:
+    case 0xDF:
+    case 0xE7:
+    case 0xEF:
+    case 0xF7:
+    case 0xFF:
+      return true;
+
+    default:
+      /* unused opcodes have a duration of 0 and stop the emulation */
+      return instruction_duration[opcode] == 0;
+  }
+}
+
+/*
+ * Decodes the instruction at 'address'.
+ * .bytes       The opcode followed by the operands of the instruction.
+ */
+void decode_instruction(decoded_inst_t *inst, gb_address_t address,
+                        const uint8_t *bytes) {
+  inst->address = address;
+  inst->opcode = bytes[0];
+  inst->length = instruction_length(bytes[0]);
+  inst->cycles = instruction_duration[bytes[0]];
+  inst->ends_block = changes_control_flow(bytes[0]);
+
+  inst->operands[0] = inst->length > 1 ? bytes[1] : (uint8_t) 0;
+  inst->operands[1] = inst->length > 2 ? bytes[2] : (uint8_t) 0;
+}
+
+#define bit_set(bits, n)  ((bits)[(n) >> 3] & (1 << ((n) & 7)))
+#define set_bit(bits, n)  (bits)[(n) >> 3] |= (uint8_t) (1 << ((n) & 7))
+
+/* fibonacci hashing of the 16 bit pc down to the number of slots */
+#define slot_index(pc)    ((((pc) * 40503u) & 0xFFFF) >> 3)
+
+static void block_cache_code_write(void *this, gb_address_t address);
+
+block_cache_t *block_cache_new(mmu_t *mmu) {
+  block_cache_t *cache = calloc(1, sizeof(block_cache_t));
+  if (!cache) return 0;
+
+  cache->mmu = mmu;
+  cache->mapping_generation = mmu_get_mapping_generation(mmu);
+  cache->generation = *cache->mapping_generation;
+  mmu_set_code_write_listener(mmu, block_cache_code_write, cache);
+  return cache;
+}
+
+void block_cache_delete(block_cache_t *cache) {
+  if (!cache) return;
+  mmu_set_code_write_listener(cache->mmu, 0, 0);
+  free(cache);
+}
+
+void block_cache_flush(block_cache_t *cache) {
+  for (int page = 0; page < BLOCK_CACHE_PAGES; ++page) {
+    if (bit_set(cache->watched_pages, page))
+      mmu_unwatch_writes(cache->mmu, (gb_address_t) (page << 8));
+  }
+
+  memset(cache->slots, 0, sizeof(cache->slots));
+  memset(cache->code_bytes, 0, sizeof(cache->code_bytes));
+  memset(cache->watched_pages, 0, sizeof(cache->watched_pages));
+  cache->num_instructions = 0;
+
+  /* the block being executed may be gone */
+  cache->generation = *cache->mapping_generation - 1;
+}
+
+static void invalidate_page(block_cache_t *cache, int page) {
+  ++cache->page_generation[page];
+  memset(cache->code_bytes + page * 32, 0, 32);
+}
+
+/* Called by the MMU for writes to pages that contain cached code. */
+static void block_cache_code_write(void *this, gb_address_t address) {
+  block_cache_t *cache = (block_cache_t *) this;
+
+  /* echo ram */
+  if (address >= 0xE000 && address < 0xFE00)
+    address -= 0x2000;
+
+  if (address >= BLOCK_CACHE_END || !bit_set(cache->code_bytes, address))
+    return;
+
+  /* blocks never cross a page, so only blocks of this page contain it */
+  invalidate_page(cache, address >> 8);
+
+  /* the block being executed may be gone */
+  cache->generation = *cache->mapping_generation - 1;
+}
+
+/*
+ * Is the instruction at 'address' completely inside of its page? The next
+ * page may be another bank after a switch, which a slot would not notice.
+ */
+static bool is_contiguous(gb_address_t address, uint8_t length) {
+  gb_address_t last = address + length - 1;
+  return last < BLOCK_CACHE_END && (last >> 8) == (address >> 8);
+}
+
+/* Marks the code of the instruction, so writes to it flush the cache. */
+static void watch_instruction(block_cache_t *cache,
+                              const decoded_inst_t *inst) {
+  for (gb_address_t address = inst->address;
+       address < inst->address + inst->length; ++address) {
+    set_bit(cache->code_bytes, address);
+
+    if (!bit_set(cache->watched_pages, address >> 8)) {
+      set_bit(cache->watched_pages, address >> 8);
+      mmu_watch_writes(cache->mmu, address);
+    }
+  }
+}
+
+static const decoded_inst_t *
+decode_block(block_cache_t *cache, gb_address_t pc, const uint8_t *source) {
+  if (cache->num_instructions + BLOCK_MAX_LENGTH > BLOCK_CACHE_SIZE)
+    block_cache_flush(cache);
+
+  decoded_inst_t *block = cache->instructions + cache->num_instructions;
+  decoded_inst_t *inst = block;
+
+  while (inst - block < BLOCK_MAX_LENGTH && pc < BLOCK_CACHE_END) {
+    /* a slot only checks the page the block starts in, the next page may
+     * be switched to another bank without the block noticing */
+    if (inst != block && (pc & 0xFF) == 0)
+      break;
+
+    if (!is_contiguous(pc, instruction_length(*source)))
+      break;
+
+    decode_instruction(inst, pc, source);
+    watch_instruction(cache, inst);
+    pc += inst->length;
+    source += inst->length;
+
+    if ((inst++)->ends_block)
+      break;
+  }
+
+  if (inst == block)
+    return 0;
+
+  /* leaving the block through its end has to look up the next one */
+  inst[-1].ends_block = true;
+  cache->num_instructions += inst - block;
+  return block;
+}
+
+/*
+ * Returns the decoded block starting at 'pc' or NULL, if the code at 'pc'
+ * can not be cached. The block is decoded if it is not in the cache yet.
+ */
+const decoded_inst_t *block_cache_lookup(block_cache_t *cache,
+                                         gb_address_t pc) {
+  if (!cache || pc >= BLOCK_CACHE_END)
+    return 0;
+
+  const uint8_t *source = mmu_get_direct_read_pointer(cache->mmu, pc);
+  if (!source)
+    return 0;
+
+  uint32_t generation = cache->page_generation[pc >> 8];
+
+  block_slot_t *slot = &cache->slots[slot_index(pc)];
+  if (slot->source != source || slot->block->address != pc
+      || slot->generation != generation) {
+    const decoded_inst_t *block = decode_block(cache, pc, source);
+    if (!block)
+      return 0;
+
+    slot->source = source;
+    slot->block = block;
+    slot->generation = generation;
+  }
+
+  cache->generation = *cache->mapping_generation;
+  return slot->block;
+}
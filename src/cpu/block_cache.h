@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct memory_management_unit mmu_t;
+typedef uint16_t gb_address_t;
+
+/*
+ * Instead of fetching and decoding every instruction anew, straight-line
+ * runs of code (blocks) get decoded once and are kept in this cache.
+ * A block ends at the first instruction that may change the control flow.
+ *
+ * Blocks are tagged with the host memory they were decoded from, so after a
+ * bank switch the same pc simply misses and is decoded again. A block never
+ * crosses a page, since only the page it starts in is checked.
+ * Code in ram is cached as well: the MMU reports writes to pages blocks were
+ * decoded from and a write to cached code invalidates the blocks of its page.
+ * Code in memory that is not mapped directly by the MMU is never cached.
+ */
+
+typedef struct decoded_instruction {
+  gb_address_t address;
+  uint8_t opcode;
+  uint8_t operands[2];
+  uint8_t length;
+  uint8_t cycles;
+  bool ends_block;
+} decoded_inst_t;
+
+/* blocks are only cached below the echo ram */
+#define BLOCK_CACHE_END   0xE000
+#define BLOCK_CACHE_SLOTS 8192
+#define BLOCK_CACHE_SIZE  16384
+#define BLOCK_MAX_LENGTH  64
+
+#define BLOCK_CACHE_PAGES (BLOCK_CACHE_END / 256)
+
+typedef struct block_cache_slot {
+  const uint8_t *source;
+  const decoded_inst_t *block;
+  /* generation of the page the block starts in, when it was decoded */
+  uint32_t generation;
+} block_slot_t;
+
+typedef struct block_cache {
+  mmu_t *mmu;
+
+  /* changes whenever the MMU maps other memory, blocks that are currently
+   * being executed have to be looked up again then */
+  const uint32_t *mapping_generation;
+  uint32_t generation;
+
+  block_slot_t slots[BLOCK_CACHE_SLOTS];
+
+  size_t num_instructions;
+  decoded_inst_t instructions[BLOCK_CACHE_SIZE];
+
+  /* every address holding cached code has its bit set */
+  uint8_t code_bytes[BLOCK_CACHE_END / 8];
+  /* pages whose writes are watched by the MMU */
+  uint8_t watched_pages[BLOCK_CACHE_PAGES / 8];
+  /* incremented when code in a page gets overwritten */
+  uint32_t page_generation[BLOCK_CACHE_PAGES];
+} block_cache_t;
+
+extern const uint8_t instruction_duration[256];
+
+block_cache_t *block_cache_new(mmu_t *mmu);
+
+void block_cache_delete(block_cache_t *cache);
+
+const decoded_inst_t *block_cache_lookup(block_cache_t *cache,
+                                         gb_address_t pc);
+
+void block_cache_flush(block_cache_t *cache);
+
+uint8_t instruction_length(uint8_t opcode);
+
+void decode_instruction(decoded_inst_t *inst, gb_address_t address,
+                        const uint8_t *bytes);
+
+/* true, if blocks returned by block_cache_lookup() can still be executed */
+static inline bool block_cache_valid(block_cache_t *cache) {
+  return cache->generation == *cache->mapping_generation;
+}
@@ -2,32 +2,108 @@
 #include <memory/mmu.h>
 #include <video/ppu.h>
 #include "interrupts.h"
+#include <save_state.h>
 
 extern void mmu_write(mmu_t *mmu, gb_address_t address, uint8_t value);
 
 extern uint8_t mmu_read(mmu_t *mmu, gb_address_t address);
 
+extern void die(const char *s);
+
 void cpu_init(cpu_t *this, mmu_t *mmu, ppu_t *lcd) {
   this->mmu = mmu;
   this->ppu = lcd;
-  timer_init(&this->timer, this, mmu);
+  scheduler_init(&this->scheduler);
+  timer_init(&this->timer, this, mmu, &this->scheduler);
+  ppu_start(lcd, &this->scheduler);
   interrupt_controller_init(&this->interrupt_controller, this, mmu);
+
+  /* without the cache, every instruction is decoded when it is executed */
+  this->block_cache = block_cache_new(mmu);
+
+#ifdef PROFILE
+  this->profiler = profiler_new();
+  if (!this->profiler)
+    die("Profiler allocation failed");
+#endif
 }
 
 void cpu_delete(cpu_t *cpu) {
+  block_cache_delete(cpu->block_cache);
+#ifdef PROFILE
+  profiler_delete(cpu->profiler);
+#endif
   mmu_delete(cpu->mmu);
   ppu_delete(cpu->ppu);
 }
 
-uint8_t cpu_read(cpu_t *cpu, gb_address_t address) {
-  return mmu_read(cpu->mmu, address);
+/*
+ * Writes the registers of the cpu and the state of the timer and the
+ * scheduler. The memory is saved separately.
+ */
+void cpu_save_state(cpu_t *cpu, state_buffer_t *state) {
+  uint8_t registers[] = {
+      cpu->A, cpu->F, cpu->B, cpu->C, cpu->D, cpu->E, cpu->H, cpu->L,
+      cpu->S, cpu->P, cpu->ei_instruction_used, cpu->interrupts_enabled,
+      cpu->halted
+  };
+  state_write_value(state, registers);
+  state_write_value(state, cpu->pc);
+
+  scheduler_save_state(&cpu->scheduler, state);
+  timer_save_state(&cpu->timer, state);
+}
+
+void cpu_load_state(cpu_t *cpu, state_buffer_t *state) {
+  uint8_t registers[13];
+  state_read_value(state, registers);
+  state_read_value(state, cpu->pc);
+
+  cpu->A = registers[0];
+  cpu->F = registers[1];
+  cpu->B = registers[2];
+  cpu->C = registers[3];
+  cpu->D = registers[4];
+  cpu->E = registers[5];
+  cpu->H = registers[6];
+  cpu->L = registers[7];
+  cpu->S = registers[8];
+  cpu->P = registers[9];
+  cpu->ei_instruction_used = registers[10];
+  cpu->interrupts_enabled = registers[11];
+  cpu->halted = registers[12];
+
+  scheduler_load_state(&cpu->scheduler, state);
+  timer_load_state(&cpu->timer, state);
+
+  /* the code in memory has been replaced behind the back of the cache */
+  if (cpu->block_cache)
+    block_cache_flush(cpu->block_cache);
+  cpu->next_instruction = 0;
+}
+
+/*
+ * Lets time pass in the middle of an instruction, running the events that
+ * became due, so the next memory access sees the timer, the ppu and the
+ * interrupt flags in the state of its machine cycle. Only used with
+ * memory timing, else the whole instruction passes at once afterwards.
+ */
+void cpu_tick(cpu_t *cpu, uint8_t cycles) {
+  scheduler_t *scheduler = &cpu->scheduler;
+  scheduler->now += cycles;
+  cpu->cycles_ticked += cycles;
+
+  if (scheduler_due(scheduler))
+    scheduler_run_events(scheduler);
 }
 
-uint8_t cpu_fetch(cpu_t *cpu) {
-  return cpu_read(cpu, ++cpu->pc);
+uint8_t cpu_read(cpu_t *cpu, gb_address_t address) {
+  if (cpu->memory_timing) cpu_tick(cpu, 4);
+  return mmu_read(cpu->mmu, address);
 }
 
 void cpu_write(cpu_t *cpu, gb_address_t address, uint8_t value) {
+  if (cpu->memory_timing) cpu_tick(cpu, 4);
   mmu_write(cpu->mmu, address, value);
 }
 
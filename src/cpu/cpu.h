@@ -3,8 +3,11 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include "scheduler.h"
 #include "timer.h"
 #include "interrupts.h"
+#include "block_cache.h"
+#include "profiler.h"
 
 typedef struct debugger debugger_t;
 
@@ -41,8 +44,28 @@ typedef struct cpu {
   bool interrupts_enabled;
   bool halted;
 
+  /* let the system run before every memory access, see cpu_tick() */
+  bool memory_timing;
+  /* the cycles of the current instruction that already passed */
+  uint8_t cycles_ticked;
+  /* the number of instructions executed so far, e.g. for benchmarks */
+  uint64_t instructions;
+
+  /* drives everything that happens besides executing instructions */
+  scheduler_t scheduler;
   cpu_timer_t timer;
   interrupt_controller_t interrupt_controller;
+
+  /* decoded rom code, may be NULL */
+  block_cache_t *block_cache;
+  /* the instruction following the current one in its block, if any */
+  const decoded_inst_t *next_instruction;
+  /* operands of the instruction currently executed */
+  const uint8_t *operands;
+
+#ifdef PROFILE
+  profiler_t *profiler;
+#endif
 } cpu_t;
 
 /* initializes cpu that is allocated on the stack */
@@ -50,9 +73,19 @@ void cpu_init(cpu_t *this, mmu_t *mmu, ppu_t *lcd);
 
 void cpu_delete(cpu_t *cpu);
 
+void cpu_save_state(cpu_t *cpu, state_buffer_t *state);
+
+void cpu_load_state(cpu_t *cpu, state_buffer_t *state);
+
+void cpu_tick(cpu_t *cpu, uint8_t cycles);
+
 uint8_t cpu_read(cpu_t *cpu, gb_address_t address);
 
-uint8_t cpu_fetch(cpu_t *cpu);
+/* returns the next operand byte of the instruction currently executed */
+static inline uint8_t cpu_fetch(cpu_t *cpu) {
+  ++cpu->pc;
+  return *cpu->operands++;
+}
 
 void cpu_write(cpu_t *cpu, gb_address_t address, uint8_t value);
 
@@ -60,11 +93,9 @@ uint8_t update_cpu_state(cpu_t *cpu, debugger_t *debugger);
 
 gb_address_t concat_bytes(uint8_t reg1, uint8_t reg2);
 
-bool ppu_update(ppu_t *ppu, uint8_t cycles);
-
 void enable_boot_rom(mmu_t *mmu);
 
-void load_boot_rom(FILE *stream);
+void load_boot_rom(mmu_t *mmu, FILE *stream);
 
 void __test_write(cpu_t *cpu, gb_address_t address, uint8_t value);
 
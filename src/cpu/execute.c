@@ -1,36 +1,79 @@
 #include <cpu/cpu.h>
+#include <memory/mmu.h>
 #include "instructions.h"
 #include "interrupts.h"
 
 #define is_halt(I)  I == 0x76
 
-uint8_t execute_instruction(cpu_t *cpu, uint8_t instruction);
+uint8_t execute_instruction(cpu_t *cpu, const decoded_inst_t *instruction);
 
 extern void die(const char *s);
 
-static const uint8_t instruction_duration[] = {
-    4, 12, 8, 8, 4, 4, 8, 4, 20, 8, 8, 8, 4, 4, 8, 4,
-    4, 12, 8, 8, 4, 4, 8, 4, 12, 8, 8, 8, 4, 4, 8, 4,
-    12, 12, 8, 8, 4, 4, 8, 4, 12, 8, 8, 8, 4, 4, 8, 4,
-    12, 12, 8, 8, 12, 12, 12, 4, 12, 8, 8, 8, 4, 4, 8, 4,
-    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
-    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
-    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
-    8, 8, 8, 8, 8, 8, 4, 8, 4, 4, 4, 4, 4, 4, 8, 4,
-    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
-    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
-    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
-    4, 4, 4, 4, 4, 4, 8, 4, 4, 4, 4, 4, 4, 4, 8, 4,
-    20, 12, 16, 16, 24, 16, 8, 16, 20, 16, 16, 0, 24, 24, 8, 16,
-    20, 12, 16,  0, 24, 16, 8, 16, 20, 16, 16, 0, 24,  0, 8, 16,
-    12, 12, 8, 0, 0, 16, 8, 16, 16, 4, 16, 0, 0, 0, 8, 16,
-    12, 12, 8, 4, 0, 16, 8, 16, 12, 8, 16, 4, 0, 0, 8, 16
-};
+extern uint8_t mmu_read(mmu_t *mmu, gb_address_t address);
+
+/*
+ * Decodes the instruction at 'address' without the block cache.
+ * .operands    The address the operands are read from.
+ */
+static void decode_uncached(cpu_t *cpu, decoded_inst_t *instruction,
+                            gb_address_t address, gb_address_t operands) {
+  uint8_t bytes[3];
+  bytes[0] = mmu_read(cpu->mmu, address);
+
+  uint8_t length = instruction_length(bytes[0]);
+  for (uint8_t i = 1; i < length; ++i)
+    bytes[i] = mmu_read(cpu->mmu, operands + i);
+
+  decode_instruction(instruction, address, bytes);
+}
+
+static const decoded_inst_t *next_instruction(cpu_t *cpu,
+                                              decoded_inst_t *buffer) {
+  const decoded_inst_t *instruction = cpu->next_instruction;
+
+  /* keep on walking the current block as long as we can */
+  if (!instruction || instruction->address != cpu->pc
+      || !block_cache_valid(cpu->block_cache))
+    instruction = block_cache_lookup(cpu->block_cache, cpu->pc);
+
+  if (instruction) {
+    cpu->next_instruction = instruction->ends_block ? 0 : instruction + 1;
+    return instruction;
+  }
+
+  cpu->next_instruction = 0;
+  decode_uncached(cpu, buffer, cpu->pc, cpu->pc);
+  return buffer;
+}
+
+/*
+ * A halted cpu executes HALT over and over until an interrupt is raised,
+ * which only an event can do. Let the time pass until the next event is
+ * due instead, in steps of the four cycles a HALT takes.
+ */
+static void skip_halt(cpu_t *cpu) {
+  scheduler_t *scheduler = &cpu->scheduler;
+
+  if (cpu->ei_instruction_used || interrupts_pending(cpu))
+    return;
+
+  /* nothing will ever wake us up, keep spinning as before */
+  if (scheduler->next_event == EVENT_NEVER || scheduler_due(scheduler))
+    return;
+
+  uint64_t steps = (scheduler->next_event - scheduler->now + 3) / 4;
+  scheduler->now += steps * 4;
+}
 
 uint8_t update_cpu_state(cpu_t *cpu, debugger_t *debugger) {
   uint8_t cycles = 0;
 
-  uint8_t instruction = cpu_read(cpu, cpu->pc);
+#ifdef PROFILE
+  uint64_t start = profiler_clock();
+#endif
+
+  decoded_inst_t buffer;
+  const decoded_inst_t *instruction = next_instruction(cpu, &buffer);
 
   /* ei delay */
   if (cpu->ei_instruction_used) {
@@ -38,14 +81,31 @@ uint8_t update_cpu_state(cpu_t *cpu, debugger_t *debugger) {
     cpu->interrupts_enabled = true;
   }
 
+  /* the opcode and the operands are always fetched first */
+  if (cpu->memory_timing) {
+    cpu->cycles_ticked = 0;
+    cpu_tick(cpu, 4 * instruction->length);
+  }
+
   cycles += execute_instruction(cpu, instruction);
+  ++cpu->instructions;
 
   if (!cpu->halted) ++cpu->pc;
 
   cycles += process_interrupts(cpu);
 
-  div_update(&cpu->timer, cycles);
-  timer_update(&cpu->timer, cycles);
+  /* the cycles without memory accesses pass at the end */
+  if (!cpu->memory_timing)
+    cpu->scheduler.now += cycles;
+  else if (cycles > cpu->cycles_ticked)
+    cpu->scheduler.now += cycles - cpu->cycles_ticked;
+
+#ifdef PROFILE
+  profiler_count(cpu->profiler, instruction, cycles, start);
+#endif
+
+  if (cpu->halted)
+    skip_halt(cpu);
 
   return cycles;
 }
@@ -54,8 +114,10 @@ unsigned int sleep(unsigned int);
 
 void freeze(void) { while (1) { /* nothing to do */ sleep(5); }}
 
-uint8_t execute_instruction(cpu_t *cpu, uint8_t instruction) {
-  switch (instruction) {
+uint8_t execute_instruction(cpu_t *cpu, const decoded_inst_t *instruction) {
+  cpu->operands = instruction->operands;
+
+  switch (instruction->opcode) {
     case 0x00: /* NOP */
       break;
 
@@ -604,10 +666,13 @@ uint8_t execute_instruction(cpu_t *cpu, uint8_t instruction) {
     case 0x76: /* HALT */ {
       /* HALT bug */
       if (!cpu->interrupts_enabled && interrupts_ready(cpu)) {
-        uint8_t next_instruction = cpu_read(cpu, cpu->pc + (uint16_t) 1);
-        if (is_halt(next_instruction)) freeze();
+        /* the byte after HALT is read twice, pc is not incremented */
+        decoded_inst_t next_instruction;
+        decode_uncached(cpu, &next_instruction, cpu->pc + (uint16_t) 1,
+                        cpu->pc);
+        if (is_halt(next_instruction.opcode)) freeze();
 
-        return 4 + execute_instruction(cpu, next_instruction);
+        return 4 + execute_instruction(cpu, &next_instruction);
       }
 
       cpu->halted = true;
@@ -1202,5 +1267,5 @@ uint8_t execute_instruction(cpu_t *cpu, uint8_t instruction) {
       break;
   }
 
-  return instruction_duration[instruction];
+  return instruction->cycles;
 }
@@ -103,6 +103,14 @@ bool interrupts_ready(cpu_t *cpu) {
   return (registers->enable & registers->flags & 0x1F) != 0;
 }
 
+/* Returns true if process_interrupts has something to do. */
+bool interrupts_pending(cpu_t *cpu) {
+  if (!cpu->interrupts_enabled)
+    return interrupts_ready(cpu);
+
+  return cpu->interrupt_controller.registers->flags != 0;
+}
+
 uint8_t process_interrupts(cpu_t *cpu) {
   /* handle halt behaviour */
   if (!cpu->interrupts_enabled) {
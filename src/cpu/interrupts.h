@@ -32,3 +32,5 @@ void raise_interrupt(cpu_t *cpu, uint8_t interrupt);
 uint8_t process_interrupts(cpu_t *cpu);
 
 bool interrupts_ready(cpu_t *cpu);
+
+bool interrupts_pending(cpu_t *cpu);
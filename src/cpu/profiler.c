@@ -0,0 +1,189 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "profiler.h"
+
+#include <logging.h>
+
+/* the addresses with the most host time that get reported */
+#define REPORTED_ADDRESSES 32
+
+/* the counts of all deleted profilers */
+static profiler_t *total;
+static pthread_mutex_t total_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* relates the ticks of profiler_clock() to nanoseconds */
+static struct {
+  uint64_t ticks;
+  uint64_t nanoseconds;
+} calibration;
+
+static uint64_t monotonic_nanoseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+typedef struct ranked_entry {
+  uint32_t key;
+  const profile_entry_t *entry;
+} ranked_entry_t;
+
+static int by_time(const void *_a, const void *_b) {
+  const profile_entry_t *a = ((const ranked_entry_t *) _a)->entry;
+  const profile_entry_t *b = ((const ranked_entry_t *) _b)->entry;
+  if (a->time != b->time)
+    return a->time < b->time ? 1 : -1;
+  return a->count < b->count ? 1 : a->count > b->count ? -1 : 0;
+}
+
+/* Sorts the entries that were executed by host time, returns their number. */
+static size_t rank_entries(const profile_entry_t *entries, size_t size,
+                           ranked_entry_t *ranked) {
+  size_t executed = 0;
+  for (size_t i = 0; i < size; ++i) {
+    if (!entries[i].count) continue;
+    ranked[executed].key = (uint32_t) i;
+    ranked[executed].entry = &entries[i];
+    ++executed;
+  }
+
+  qsort(ranked, executed, sizeof(ranked_entry_t), by_time);
+  return executed;
+}
+
+static void print_entry(FILE *out, const char *name,
+                        const profile_entry_t *entry,
+                        const profile_entry_t *sum, double ns_per_tick) {
+  fprintf(out, "  %-10s %14llu %7.2f%% %7.2f%% %9.1f %14llu\n", name,
+          (unsigned long long) entry->count,
+          100.0 * entry->count / sum->count,
+          sum->time ? 100.0 * entry->time / sum->time : 0.0,
+          ns_per_tick * entry->time / entry->count,
+          (unsigned long long) entry->cycles);
+}
+
+static void print_header(FILE *out, const char *title) {
+  fprintf(out, "%s\n  %-10s %14s %8s %8s %9s %14s\n", title, "",
+          "executions", "instr", "time", "ns/exec", "cycles");
+}
+
+static void profiler_report(FILE *out, const profiler_t *profile) {
+  static ranked_entry_t ranked[0x10000];
+  char name[16];
+
+  uint64_t elapsed = monotonic_nanoseconds() - calibration.nanoseconds;
+  uint64_t ticks = profiler_clock() - calibration.ticks;
+  double ns_per_tick = ticks ? (double) elapsed / ticks : 1.0;
+
+  profile_entry_t sum = {0};
+  for (int i = 0; i < PROFILER_OPCODES; ++i) {
+    sum.count += profile->opcodes[i].count;
+    sum.cycles += profile->opcodes[i].cycles;
+    sum.time += profile->opcodes[i].time;
+  }
+
+  if (!sum.count)
+    return;
+
+  fprintf(out, "Profile: %llu instructions, %llu cycles, %.3f s\n",
+          (unsigned long long) sum.count, (unsigned long long) sum.cycles,
+          ns_per_tick * sum.time / 1e9);
+
+  print_header(out, "Opcodes:");
+  size_t size = rank_entries(profile->opcodes, PROFILER_OPCODES, ranked);
+  for (size_t i = 0; i < size; ++i) {
+    uint32_t opcode = ranked[i].key;
+    if (opcode & 0x100)
+      snprintf(name, sizeof(name), "CB %02X", opcode & 0xFF);
+    else
+      snprintf(name, sizeof(name), "%02X", opcode);
+    print_entry(out, name, ranked[i].entry, &sum, ns_per_tick);
+  }
+
+  print_header(out, "Rom banks:");
+  size = rank_entries(profile->banks, PROFILER_BANKS + 1, ranked);
+  for (size_t i = 0; i < size; ++i) {
+    if (ranked[i].key == PROFILER_NO_BANK)
+      snprintf(name, sizeof(name), "ram");
+    else
+      snprintf(name, sizeof(name), "%u", ranked[i].key);
+    print_entry(out, name, ranked[i].entry, &sum, ns_per_tick);
+  }
+
+  print_header(out, "Addresses:");
+  size = rank_entries(profile->addresses, 0x10000, ranked);
+  for (size_t i = 0; i < size && i < REPORTED_ADDRESSES; ++i) {
+    snprintf(name, sizeof(name), "%04X", ranked[i].key);
+    print_entry(out, name, ranked[i].entry, &sum, ns_per_tick);
+  }
+}
+
+static void report_total(void) {
+  pthread_mutex_lock(&total_lock);
+  profiler_report(stderr, total);
+  free(total);
+  total = 0;
+  pthread_mutex_unlock(&total_lock);
+}
+
+static void add_entries(profile_entry_t *to, const profile_entry_t *from,
+                        size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    to[i].count += from[i].count;
+    to[i].cycles += from[i].cycles;
+    to[i].time += from[i].time;
+  }
+}
+
+profiler_t *profiler_new(void) {
+  profiler_t *profiler = calloc(1, sizeof(profiler_t));
+  if (!profiler) {
+    logging_std_error();
+    return 0;
+  }
+
+  pthread_mutex_lock(&total_lock);
+  if (!calibration.ticks) {
+    calibration.ticks = profiler_clock();
+    calibration.nanoseconds = monotonic_nanoseconds();
+  }
+  pthread_mutex_unlock(&total_lock);
+
+  return profiler;
+}
+
+void profiler_delete(profiler_t *this) {
+  if (!this)
+    return;
+
+  pthread_mutex_lock(&total_lock);
+  if (!total) {
+    static bool registered = false;
+    total = calloc(1, sizeof(profiler_t));
+    if (total && !registered) {
+      atexit(report_total);
+      registered = true;
+    }
+  }
+
+  if (total) {
+    add_entries(total->opcodes, this->opcodes, PROFILER_OPCODES);
+    add_entries(total->addresses, this->addresses, 0x10000);
+    add_entries(total->banks, this->banks, PROFILER_BANKS + 1);
+  }
+  pthread_mutex_unlock(&total_lock);
+
+  free(this);
+}
+
+/*
+ * Lets the profiler count the instructions at 0x4000 - 0x7FFF for the bank
+ * that is mapped there, instead of bank 1.
+ */
+void profiler_set_rom_bank_query(profiler_t *this, rom_bank_query_t query,
+                                 void *context) {
+  this->rom_bank = query;
+  this->context = context;
+}
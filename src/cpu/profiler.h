@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include "block_cache.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Counts the executions, the emulated cycles and the host time of every
+ * opcode, every pc and every rom bank. Only compiled in with PROFILE
+ * defined (cmake -DPROFILE=ON); the counts of all cpus are added up and
+ * reported, sorted by host time, when the program exits.
+ */
+
+/* the 256 opcodes, followed by the 256 CB opcodes */
+#define PROFILER_OPCODES 512
+#define PROFILER_BANKS 512
+/* code executed outside of the rom */
+#define PROFILER_NO_BANK PROFILER_BANKS
+
+/* returns the rom bank mapped to 0x4000 - 0x7FFF */
+typedef uint16_t (*rom_bank_query_t)(void *context);
+
+typedef struct profile_entry {
+  uint64_t count;
+  uint64_t cycles;
+  /* ticks of profiler_clock() */
+  uint64_t time;
+} profile_entry_t;
+
+typedef struct profiler {
+  profile_entry_t opcodes[PROFILER_OPCODES];
+  profile_entry_t addresses[0x10000];
+  profile_entry_t banks[PROFILER_BANKS + 1];
+
+  rom_bank_query_t rom_bank;
+  void *context;
+} profiler_t;
+
+profiler_t *profiler_new(void);
+
+/* Adds the counts to the report and deletes the profiler. */
+void profiler_delete(profiler_t *this);
+
+void profiler_set_rom_bank_query(profiler_t *this, rom_bank_query_t query,
+                                 void *context);
+
+/* the time stamp counter if there is one, it is much cheaper to read */
+static inline uint64_t profiler_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+static inline void profile_entry_add(profile_entry_t *entry, uint8_t cycles,
+                                     uint64_t time) {
+  ++entry->count;
+  entry->cycles += cycles;
+  entry->time += time;
+}
+
+static inline uint16_t profiler_bank(profiler_t *this, gb_address_t address) {
+  if (address < 0x4000)
+    return 0;
+  if (address >= 0x8000)
+    return PROFILER_NO_BANK;
+  if (!this->rom_bank)
+    return 1;
+  return this->rom_bank(this->context) % PROFILER_BANKS;
+}
+
+/*
+ * Counts one executed instruction.
+ * .start       profiler_clock() before the instruction was executed.
+ */
+static inline void profiler_count(profiler_t *this,
+                                  const decoded_inst_t *instruction,
+                                  uint8_t cycles, uint64_t start) {
+  uint64_t time = profiler_clock() - start;
+
+  uint16_t opcode = instruction->opcode;
+  if (opcode == 0xCB)
+    opcode = 0x100 | instruction->operands[0];
+
+  profile_entry_add(&this->opcodes[opcode], cycles, time);
+  profile_entry_add(&this->addresses[instruction->address], cycles, time);
+  profile_entry_add(&this->banks[profiler_bank(this, instruction->address)],
+                    cycles, time);
+}
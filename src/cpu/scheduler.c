@@ -0,0 +1,66 @@
+#include <save_state.h>
+#include "scheduler.h"
+
+static void update_next_event(scheduler_t *this) {
+  uint64_t next = EVENT_NEVER;
+  for (int i = 0; i < NUM_EVENTS; ++i) {
+    if (this->events[i].time < next)
+      next = this->events[i].time;
+  }
+  this->next_event = next;
+}
+
+void scheduler_init(scheduler_t *this) {
+  this->now = 0;
+  for (int i = 0; i < NUM_EVENTS; ++i)
+    this->events[i].time = EVENT_NEVER;
+  this->next_event = EVENT_NEVER;
+}
+
+void scheduler_register(scheduler_t *this, event_id_t id,
+                        event_callback_t callback, void *context) {
+  this->events[id].callback = callback;
+  this->events[id].context = context;
+}
+
+/* Schedules the event for 'time', replacing an earlier schedule. */
+void scheduler_schedule(scheduler_t *this, event_id_t id, uint64_t time) {
+  this->events[id].time = time;
+  update_next_event(this);
+}
+
+void scheduler_cancel(scheduler_t *this, event_id_t id) {
+  scheduler_schedule(this, id, EVENT_NEVER);
+}
+
+/* Runs all events that are due, in the order they were scheduled for. */
+void scheduler_run_events(scheduler_t *this) {
+  while (scheduler_due(this)) {
+    event_t *event = this->events;
+    for (int i = 1; i < NUM_EVENTS; ++i) {
+      if (this->events[i].time < event->time)
+        event = &this->events[i];
+    }
+
+    /* events are one-shot, the callback may schedule the next one */
+    uint64_t time = event->time;
+    event->time = EVENT_NEVER;
+    update_next_event(this);
+
+    event->callback(event->context, time);
+  }
+}
+
+/* Only the times are saved, the callbacks are registered again on start. */
+void scheduler_save_state(scheduler_t *this, state_buffer_t *state) {
+  state_write_value(state, this->now);
+  for (int i = 0; i < NUM_EVENTS; ++i)
+    state_write_value(state, this->events[i].time);
+}
+
+void scheduler_load_state(scheduler_t *this, state_buffer_t *state) {
+  state_read_value(state, this->now);
+  for (int i = 0; i < NUM_EVENTS; ++i)
+    state_read_value(state, this->events[i].time);
+  update_next_event(this);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Components that change their state at known points in time (the PPU
+ * switching modes, TIMA overflowing) register an event here instead of
+ * being updated after every instruction. The cpu runs until the next event
+ * is due, then the event callbacks are run.
+ *
+ * Time is measured in cpu cycles since power on.
+ */
+
+typedef enum {
+  EVENT_PPU,
+  EVENT_TIMER,
+  NUM_EVENTS
+} event_id_t;
+
+#define EVENT_NEVER UINT64_MAX
+
+typedef struct state_buffer state_buffer_t;
+
+/* gets called with the time the event was scheduled for */
+typedef void (*event_callback_t)(void *context, uint64_t time);
+
+typedef struct event {
+  uint64_t time;
+  event_callback_t callback;
+  void *context;
+} event_t;
+
+typedef struct scheduler {
+  uint64_t now;
+  /* time of the earliest event */
+  uint64_t next_event;
+  event_t events[NUM_EVENTS];
+} scheduler_t;
+
+void scheduler_init(scheduler_t *this);
+
+void scheduler_register(scheduler_t *this, event_id_t id,
+                        event_callback_t callback, void *context);
+
+void scheduler_schedule(scheduler_t *this, event_id_t id, uint64_t time);
+
+void scheduler_cancel(scheduler_t *this, event_id_t id);
+
+void scheduler_run_events(scheduler_t *this);
+
+void scheduler_save_state(scheduler_t *this, state_buffer_t *state);
+
+void scheduler_load_state(scheduler_t *this, state_buffer_t *state);
+
+static inline bool scheduler_due(scheduler_t *this) {
+  return this->now >= this->next_event;
+}
@@ -1,6 +1,7 @@
 #include <cpu/cpu.h>
 #include <cpu/interrupts.h>
 #include <memory/mmu.h>
+#include <save_state.h>
 #include "timer.h"
 
 static const uint16_t input_clock_types[] = {
@@ -14,8 +15,11 @@ typedef struct timer_registers {
   uint8_t control;
 } timer_regs_t;
 
+static void schedule_overflow(cpu_timer_t *this);
+
 DEF_MEM_READ(timer_read) {
   timer_mem_handler_t *handler =(timer_mem_handler_t *)this;
+  timer_sync(handler->timer);
   return ((uint8_t *)handler->timer->registers)[address - 0xFF04];
 }
 
@@ -23,6 +27,8 @@ DEF_MEM_WRITE(timer_write) {
   timer_mem_handler_t *handler =(timer_mem_handler_t *)this;
   timer_regs_t *regs = handler->timer->registers;
 
+  timer_sync(handler->timer);
+
   if (address == 0xFF07) {
     value &= 7;
     if ((regs->control & 3) != (value & 3)) {
@@ -33,9 +39,19 @@ DEF_MEM_WRITE(timer_write) {
   }
 
   ((uint8_t *)handler->timer->registers)[address - 0xFF04] = value;
+
+  schedule_overflow(handler->timer);
+}
+
+static void timer_overflow_event(void *context, uint64_t time) {
+  (void) time;
+  cpu_timer_t *timer = (cpu_timer_t *) context;
+  timer_sync(timer);
+  schedule_overflow(timer);
 }
 
-void timer_init(cpu_timer_t *this, cpu_t *cpu, mmu_t *mmu) {
+void timer_init(cpu_timer_t *this, cpu_t *cpu, mmu_t *mmu,
+                scheduler_t *scheduler) {
   this->handler.base.read = timer_read;
   this->handler.base.write = timer_write;
   this->handler.base.destroy = mem_handler_stack_destroy;
@@ -47,15 +63,51 @@ void timer_init(cpu_timer_t *this, cpu_t *cpu, mmu_t *mmu) {
   mmu_register_mem_handler(mmu, (mem_handler_t *)&this->handler, tuple.handle);
 
   this->interrupt_line = cpu;
+  this->scheduler = scheduler;
+  this->last_sync = scheduler->now;
+
+  /* the registers may still be set up behind our back, look at them once
+   * the cpu is running */
+  scheduler_register(scheduler, EVENT_TIMER, timer_overflow_event, this);
+  scheduler_schedule(scheduler, EVENT_TIMER, scheduler->now);
+}
+
+/*
+ * Schedules an event for the moment TIMA overflows, that is when the
+ * interrupt has to be raised.
+ */
+static void schedule_overflow(cpu_timer_t *this) {
+  uint8_t reg = this->registers->control;
+
+  if (!(reg & 4)) {
+    scheduler_cancel(this->scheduler, EVENT_TIMER);
+    return;
+  }
+
+  uint16_t type = input_clock_types[reg & 3];
+  uint64_t ticks = 0x100 - this->registers->counter;
+
+  uint64_t time = this->last_sync + type - this->clock + (ticks - 1) * type;
+  scheduler_schedule(this->scheduler, EVENT_TIMER, time);
 }
 
-void timer_update(cpu_timer_t *this, uint8_t cycles) {
+/*
+ * Advances DIV and TIMA by the cycles passed since the last sync.
+ */
+void timer_sync(cpu_timer_t *this) {
+  uint64_t cycles = this->scheduler->now - this->last_sync;
+  this->last_sync = this->scheduler->now;
+
+  this->div_clock += cycles;
+  this->registers->div += this->div_clock / 256;
+  this->div_clock %= 256;
+
   uint8_t reg = this->registers->control;
 
   uint8_t timer_start = reg & (uint8_t) 4;
   if (!timer_start) return;
 
-  uint32_t timer_clock = this->clock;
+  uint64_t timer_clock = this->clock;
   timer_clock += cycles;
 
   uint8_t input_clock_select = reg & (uint8_t) 3;
@@ -77,14 +129,18 @@ void timer_update(cpu_timer_t *this, uint8_t cycles) {
     this->registers->counter = tima;
   }
 
-  this->clock = timer_clock;
+  this->clock = (uint32_t) timer_clock;
 }
 
-void div_update(cpu_timer_t *this, uint8_t cycles) {
-  this->div_clock += cycles;
+/* The registers themselves are part of the high memory of the mmu. */
+void timer_save_state(cpu_timer_t *this, state_buffer_t *state) {
+  state_write_value(state, this->clock);
+  state_write_value(state, this->div_clock);
+  state_write_value(state, this->last_sync);
+}
 
-  if (this->div_clock >= 256) {
-    this->div_clock -= 256;
-    ++this->registers->div;
-  }
-}
\ No newline at end of file
+void timer_load_state(cpu_timer_t *this, state_buffer_t *state) {
+  state_read_value(state, this->clock);
+  state_read_value(state, this->div_clock);
+  state_read_value(state, this->last_sync);
+}
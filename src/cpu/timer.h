@@ -1,6 +1,7 @@
 #pragma once
 #include <stdint.h>
 #include <memory/memory_handler.h>
+#include "scheduler.h"
 
 typedef struct cpu cpu_t;
 typedef struct memory_management_unit mmu_t;
@@ -14,12 +15,17 @@ typedef struct timer_memory_handler {
 
 typedef struct timer {
   cpu_t *interrupt_line;
+  scheduler_t *scheduler;
   timer_regs_t *registers;
   uint32_t clock;
   uint32_t div_clock;
+  /* the registers are brought up to date lazily, see timer_sync */
+  uint64_t last_sync;
   timer_mem_handler_t handler;
 } cpu_timer_t;
 
-void timer_update(cpu_timer_t *this, uint8_t cycles);
-void timer_init(cpu_timer_t *this, cpu_t *cpu, mmu_t *mmu);
-void div_update(cpu_timer_t *this, uint8_t cycles);
+void timer_init(cpu_timer_t *this, cpu_t *cpu, mmu_t *mmu,
+                scheduler_t *scheduler);
+void timer_sync(cpu_timer_t *this);
+void timer_save_state(cpu_timer_t *this, state_buffer_t *state);
+void timer_load_state(cpu_timer_t *this, state_buffer_t *state);
@@ -0,0 +1,61 @@
+#include <errno.h>
+#include <time.h>
+
+#include "frame_pacer.h"
+
+#define NS_PER_SECOND 1000000000LL
+
+/* when we are this many frames late, we do not try to catch up anymore */
+#define MAX_FRAMES_BEHIND 4
+
+int64_t frame_pacer_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t) now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+/*
+ * Starts pacing with the next frame.
+ * .speed       1 is the speed of the game boy, clamped to
+ *              [MIN_SPEED, MAX_SPEED].
+ */
+void frame_pacer_start(frame_pacer_t *this, double speed) {
+  if (!(speed >= MIN_SPEED)) speed = MIN_SPEED;
+  if (speed > MAX_SPEED) speed = MAX_SPEED;
+
+  this->frame_duration =
+      (double) FRAME_CYCLES * NS_PER_SECOND / CLOCK_SPEED / speed;
+  this->origin = frame_pacer_now();
+  this->frames = 0;
+}
+
+static void sleep_until(int64_t deadline) {
+  struct timespec until = {
+      .tv_sec = deadline / NS_PER_SECOND,
+      .tv_nsec = deadline % NS_PER_SECOND
+  };
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, 0) == EINTR)
+    ;
+}
+
+/*
+ * Waits until the current frame is due to end. After a stall, e.g. when the
+ * process was suspended, the pacing starts over instead of running as fast
+ * as possible until it caught up.
+ */
+void frame_pacer_wait(frame_pacer_t *this) {
+  ++this->frames;
+  int64_t deadline =
+      this->origin + (int64_t) (this->frames * this->frame_duration);
+
+  int64_t now = frame_pacer_now();
+  if (now - deadline > MAX_FRAMES_BEHIND * this->frame_duration) {
+    this->origin = now;
+    this->frames = 0;
+    return;
+  }
+
+  if (now < deadline)
+    sleep_until(deadline);
+}
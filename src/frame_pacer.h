@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+/* one frame of the game boy: 70224 cycles at 4.194304 MHz, ~59.73 Hz */
+#define FRAME_CYCLES 70224
+#define CLOCK_SPEED 4194304
+
+#define MIN_SPEED 0.5
+#define MAX_SPEED 8.0
+
+/*
+ * Paces the frames to real time. Every frame has an absolute deadline,
+ * counted from a fixed origin, so neither sleeping too long nor rounding
+ * errors add up over time.
+ */
+typedef struct frame_pacer {
+  /* nanoseconds on the monotonic clock */
+  int64_t origin;
+  double frame_duration;
+  uint64_t frames;
+} frame_pacer_t;
+
+void frame_pacer_start(frame_pacer_t *this, double speed);
+
+void frame_pacer_wait(frame_pacer_t *this);
+
+int64_t frame_pacer_now(void);
@@ -1,8 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
-#include <unistd.h>
-#include <math.h>
 
 #include <cpu/cpu.h>
 #include <memory/mmu.h>
@@ -14,6 +12,10 @@
 
 #include "gameboy.h"
 #include "cartridge.h"
+#include "logging.h"
+#include "save_state.h"
+#include "rewind.h"
+#include "frame_pacer.h"
 
 extern input_ctrl_t *input_ctrl_impl_new(cpu_t *interrupt_line, mmu_t *mmu);
 
@@ -21,9 +23,9 @@ extern void input_ctrl_impl_delete(input_ctrl_t *input);
 
 extern void die(const char *s);
 
-static bool set_up_boot_rom(const char *boot_file);
+static bool set_up_boot_rom(mmu_t *mmu, const char *boot_file);
 
-static void wait_until_next_frame(double time_spent);
+static double monotonic_seconds(void);
 
 typedef struct game_boy_t game_boy_t;
 
@@ -41,6 +43,20 @@ typedef struct game_boy_t {
   cartridge_t *cartridge;
   display_t *display;
 
+  /* run as fast as possible, without waiting for the next frame */
+  bool turbo;
+  /* showing a frame waits for the screen, no need to pace frames */
+  bool vsync;
+  double speed;
+  /* stop after this many frames, 0 means run forever */
+  uint32_t frame_limit;
+  /* no cartridge inserted, the cartridge memory reads as 0 */
+  bool null_cartridge;
+  /* records the state after every frame, may be NULL */
+  rewind_buffer_t *rewind;
+  /* used for the cartridges inserted from now on */
+  save_policy_t save_policy;
+
   uint8_t vram[8 * 1024];
 } game_boy_t;
 
@@ -49,12 +65,14 @@ typedef struct game_boy_t {
  * The structure should be freed with game_boy_delete().
  * .boot_file       If provided, the boot sequence is run before any cartridge
  *                  runs. The boot file has to contain 256 bytes of code.
- * .surface         The structure the LCD content is drawn on.
+ * .display         The structure the LCD content is drawn on. May be NULL,
+ *                  in which case nothing gets rendered (headless mode).
  */
 gb_t game_boy_new(const char *boot_file, display_t *display,
                   input_strategy_t *input_strategy) {
   game_boy_t *game_boy = calloc(1, sizeof(game_boy_t));
   if (!game_boy) return 0;
+  game_boy->speed = 1.0;
 
   mmu_t *mmu = mmu_new();
   if (!mmu) {
@@ -80,7 +98,7 @@ gb_t game_boy_new(const char *boot_file, display_t *display,
   game_boy->joy_pad = input_strategy;
   game_boy->display = display;
 
-  if (boot_file && set_up_boot_rom(boot_file))
+  if (boot_file && set_up_boot_rom(mmu, boot_file))
     enable_boot_rom(mmu);
   else
     game_boy_entry_after_boot(game_boy);
@@ -93,14 +111,16 @@ void game_boy_delete(gb_t gb) {
   input_ctrl_impl_delete(gb->joy_pad->controller);
   gb->joy_pad->delete(gb->joy_pad);
   cartridge_delete(gb->cartridge);
+  if (gb->rewind) rewind_buffer_delete(gb->rewind);
   free(gb);
 }
 
 /*
  * Set up the boot rom. Returns false if an error occured.
+ * .mmu             The boot code is stored in the memory of this mmu
  * .boot_file       The file containing the boot code
  */
-static bool set_up_boot_rom(const char *boot_file) {
+static bool set_up_boot_rom(mmu_t *mmu, const char *boot_file) {
   FILE *stream = fopen(boot_file, "r");
   if (!stream) {
     perror(boot_file);
@@ -124,7 +144,7 @@ static bool set_up_boot_rom(const char *boot_file) {
     return false;
   }
 
-  load_boot_rom(stream);
+  load_boot_rom(mmu, stream);
   fclose(stream);
   return true;
 }
@@ -154,10 +174,111 @@ void game_boy_entry_after_boot(gb_t gb) {
   mmu_init_after_boot(cpu->mmu);
 }
 
+/*
+ * Enables or disables turbo mode. In turbo mode the game boy does not wait
+ * for the next frame but runs as fast as the host allows. The emulated
+ * frames per second get reported instead.
+ */
+void game_boy_set_turbo(gb_t gb, bool turbo) {
+  gb->turbo = turbo;
+}
+
+/*
+ * Makes game_boy_run() return after the given amount of frames.
+ * .frames      The number of frames to run, 0 disables the limit.
+ */
+void game_boy_set_frame_limit(gb_t gb, uint32_t frames) {
+  gb->frame_limit = frames;
+}
+
+/*
+ * Tells the game boy that showing a frame on its display waits for the
+ * vertical sync of the screen, which then paces the frames.
+ */
+void game_boy_set_vsync(gb_t gb, bool vsync) {
+  gb->vsync = vsync;
+}
+
+/*
+ * Lets the timer, the ppu and the interrupts advance before every memory
+ * access of an instruction instead of after the whole instruction. This is
+ * slower, but needed by games and tests that depend on exact timing.
+ */
+void game_boy_set_memory_timing(gb_t gb, bool enabled) {
+  gb->cpu.memory_timing = enabled;
+}
+
+/*
+ * Maps the save file of the games inserted from now on as their cartridge
+ * ram, so the game writes the file directly and saving takes no time.
+ * .sync_interval   Seconds between syncs of the file to the disk while the
+ *                  game writes the ram, 0 syncs only when the game is
+ *                  removed.
+ */
+void game_boy_map_save_file(gb_t gb, uint32_t sync_interval) {
+  gb->save_policy.mapped = true;
+  gb->save_policy.sync_interval = sync_interval;
+}
+
+/*
+ * Runs the game boy faster or slower than the real one. Only the vertical
+ * sync paces normal speed.
+ * .speed       A multiplier from 0.5 to 8.
+ */
+void game_boy_set_speed(gb_t gb, double speed) {
+  gb->speed = speed;
+}
+
+/*
+ * Draws only every nth frame, e.g. to fast-forward or for bots that only
+ * read the memory. The emulation itself is not affected.
+ * .interval    Draw every 'interval' frames, 1 draws all, 0 none.
+ */
+void game_boy_set_frame_skip(gb_t gb, uint32_t interval) {
+  ppu_set_render_interval(gb->cpu.ppu, interval);
+}
+
+/* Returns the number of cycles the game boy ran so far, at 4.194304 MHz. */
+uint64_t game_boy_cycles(gb_t gb) {
+  return gb->cpu.scheduler.now;
+}
+
+/* Returns the number of instructions the cpu executed so far. */
+uint64_t game_boy_instructions(gb_t gb) {
+  return gb->cpu.instructions;
+}
+
+#ifdef PROFILE
+static uint16_t current_rom_bank(void *cartridge) {
+  return cartridge_get_rom_bank((cartridge_t *) cartridge);
+}
+#endif
+
+/* maps the selected banks directly, so reading them needs no handler */
+static void map_cartridge_banks(void *context) {
+  game_boy_t *gb = (game_boy_t *) context;
+  mmu_t *mmu = gb->cpu.mmu;
+
+  uint8_t *rom = (uint8_t *) cartridge_get_rom_window(gb->cartridge);
+  if (mmu_get_direct_read_pointer(mmu, 0x4000) != rom)
+    mmu_map_direct_memory(mmu, 0x4000, 0x7FFF, rom, MMU_DIRECT_READ);
+
+  uint8_t *ram = cartridge_get_ram_window(gb->cartridge);
+  if (mmu_get_direct_read_pointer(mmu, 0xA000) == ram)
+    return;
+
+  /* writes still go through the cartridge */
+  if (ram)
+    mmu_map_direct_memory(mmu, 0xA000, 0xBFFF, ram, MMU_DIRECT_READ);
+  else
+    mmu_unmap_direct_memory(mmu, 0xA000, 0xBFFF);
+}
+
 void game_boy_insert_game(gb_t gb, const char *game_path,
                           const char *save_file) {
   if (gb->cartridge) cartridge_delete(gb->cartridge);
-  gb->cartridge = cartridge_new(game_path, save_file);
+  gb->cartridge = cartridge_new(game_path, save_file, &gb->save_policy);
+  if (!gb->cartridge) die("Cartridge could not be inserted");
 
   mmu_t *mmu = gb->cpu.mmu;
 
@@ -165,7 +286,208 @@ void game_boy_insert_game(gb_t gb, const char *game_path,
   mmu_assign_rom_handler(mmu, handler);
   mmu_assign_extram_handler(mmu, handler);
 
-  if (!gb->cartridge) die("Cartridge could not be inserted");
+  /* reads from the fixed bank never need the memory bank controller */
+  mmu_map_direct_memory(mmu, 0x0000, 0x3FFF,
+                        cartridge_get_fixed_rom_bank(gb->cartridge),
+                        MMU_DIRECT_READ);
+
+  /* the banked memory is mapped anew on every bank switch */
+  cartridge_set_bank_switch_listener(gb->cartridge, map_cartridge_banks, gb);
+  map_cartridge_banks(gb);
+
+  cartridge_set_clock(gb->cartridge, &gb->cpu.scheduler.now);
+
+#ifdef PROFILE
+  profiler_set_rom_bank_query(gb->cpu.profiler, current_rom_bank,
+                              gb->cartridge);
+#endif
+}
+
+/* the cartridge comes first, so a state of another game is rejected early */
+static void save_components(game_boy_t *gb, state_buffer_t *state) {
+  if (gb->cartridge)
+    cartridge_save_state(gb->cartridge, state);
+
+  cpu_save_state(&gb->cpu, state);
+  mmu_save_state(gb->cpu.mmu, state);
+  ppu_save_state(gb->cpu.ppu, state);
+  state_write_value(state, gb->vram);
+}
+
+/*
+ * Returns the number of bytes game_boy_save_state() needs. It only depends
+ * on the inserted cartridge.
+ */
+size_t game_boy_state_size(gb_t gb) {
+  state_buffer_t state = {0};
+  save_state_header_t header = {0};
+  state_write_value(&state, header);
+  save_components(gb, &state);
+  return state.position;
+}
+
+/*
+ * Writes the complete state of the machine to the buffer, without any
+ * allocation. Returns false if the buffer is too small.
+ * .buffer      At least game_boy_state_size() bytes.
+ */
+bool game_boy_save_state(gb_t gb, void *buffer, size_t size) {
+  size_t state_size = game_boy_state_size(gb);
+  if (size < state_size)
+    return false;
+
+  save_state_header_t header = {
+      .magic = SAVE_STATE_MAGIC,
+      .version = SAVE_STATE_VERSION,
+      .size = state_size
+  };
+
+  state_buffer_t state = {.data = buffer, .size = size};
+  state_write_value(&state, header);
+  save_components(gb, &state);
+  return true;
+}
+
+/*
+ * Restores a state written by game_boy_save_state(). Returns false, without
+ * changing the machine, if the buffer holds no state of this version or the
+ * state belongs to another game.
+ */
+bool game_boy_load_state(gb_t gb, const void *buffer, size_t size) {
+  state_buffer_t state = {.data = (uint8_t *) buffer, .size = size};
+
+  save_state_header_t header;
+  if (size < sizeof(header))
+    return false;
+  state_read_value(&state, header);
+
+  if (header.magic != SAVE_STATE_MAGIC || header.version != SAVE_STATE_VERSION
+      || header.size != game_boy_state_size(gb) || size < header.size)
+    return false;
+
+  if (gb->cartridge && !cartridge_load_state(gb->cartridge, &state))
+    return false;
+
+  cpu_load_state(&gb->cpu, &state);
+  mmu_load_state(gb->cpu.mmu, &state);
+  ppu_load_state(gb->cpu.ppu, &state);
+  state_read_value(&state, gb->vram);
+  return true;
+}
+
+/*
+ * Keeps the last frames in a history of the given size in bytes, so the
+ * game can be rewound with game_boy_rewind(). A size of 0 disables the
+ * history. Returns false if the history could not be created.
+ */
+bool game_boy_set_rewind(gb_t gb, size_t capacity) {
+  if (gb->rewind) {
+    rewind_buffer_delete(gb->rewind);
+    gb->rewind = 0;
+  }
+
+  if (!capacity)
+    return true;
+
+  gb->rewind = rewind_buffer_new(capacity);
+  return gb->rewind != 0;
+}
+
+static void record_rewind_state(game_boy_t *gb) {
+  size_t size = game_boy_state_size(gb);
+
+  uint8_t *state = rewind_buffer_next(gb->rewind, size);
+  if (!state)
+    return;
+
+  game_boy_save_state(gb, state, size);
+  rewind_buffer_push(gb->rewind);
+}
+
+/*
+ * Goes back the given amount of frames, or as far as the history reaches.
+ * Returns the number of frames the game boy went back.
+ */
+uint32_t game_boy_rewind(gb_t gb, uint32_t frames) {
+  if (!gb->rewind)
+    return 0;
+
+  uint32_t rewound = 0;
+  while (rewound < frames && rewind_buffer_pop(gb->rewind))
+    ++rewound;
+
+  const uint8_t *state = rewind_buffer_newest(gb->rewind);
+  if (rewound && state)
+    game_boy_load_state(gb, state, rewind_buffer_state_size(gb->rewind));
+
+  return rewound;
+}
+
+/* if no cartridge is present, set all the related memory to 0 */
+static void insert_null_cartridge(game_boy_t *gb) {
+  if (gb->cartridge || gb->null_cartridge)
+    return;
+
+  mem_handler_t *handler = null_handler_create();
+  if (!handler)
+    die("Mem_handler allocation failed");
+
+  mmu_t *mmu = gb->cpu.mmu;
+  mmu_assign_rom_handler(mmu, handler);
+  mmu_assign_extram_handler(mmu, handler);
+  mmu_assign_vram_handler(mmu, handler);
+  gb->null_cartridge = true;
+}
+
+/*
+ * Runs the game boy until the next frame is completed, then handles input
+ * and shows the frame. Returns false if the player wants to quit.
+ */
+static bool run_frame(game_boy_t *gb) {
+  debugger_t *debugger = 0;
+  scheduler_t *scheduler = &gb->cpu.scheduler;
+
+  do {
+    /* run the cpu until the next event is due */
+    while (!scheduler_due(scheduler))
+      update_cpu_state(&gb->cpu, debugger);
+
+    scheduler_run_events(scheduler);
+  } while (!ppu_frame_ready(gb->cpu.ppu));
+
+  if (gb->joy_pad->handle_button_press(gb->joy_pad)) {
+    /* quit game */
+    return false;
+  }
+
+  /* draw to screen*/
+  if (gb->display && ppu_frame_drawn(gb->cpu.ppu))
+    gb->display->show(gb->display);
+
+  if (gb->rewind)
+    record_rewind_state(gb);
+
+  if (gb->cartridge)
+    cartridge_end_frame(gb->cartridge);
+
+  return true;
+}
+
+/*
+ * Runs the given amount of frames as fast as possible, without frame pacing
+ * or reporting. Returns false if the player wants to quit.
+ * .gb          The game boy structure.
+ * .frames      The number of frames to run.
+ */
+bool game_boy_run_frames(gb_t gb, uint32_t frames) {
+  insert_null_cartridge(gb);
+
+  while (frames--) {
+    if (!run_frame(gb))
+      return false;
+  }
+
+  return true;
 }
 
 /*
@@ -176,62 +498,67 @@ void game_boy_insert_game(gb_t gb, const char *game_path,
  * .window      The window that displays the LCD content to the screen.
  */
 void game_boy_run(gb_t gb) {
-  /* if no cartridge is present, set all the related memory to 0 */
-  if (!gb->cartridge) {
-    mem_handler_t *handler = null_handler_create();
-    if (!handler)
-      die("Mem_handler allocation failed");
-
-    mmu_t *mmu = gb->cpu.mmu;
-    mmu_assign_rom_handler(mmu, handler);
-    mmu_assign_extram_handler(mmu, handler);
-    mmu_assign_vram_handler(mmu, handler);
-  }
-
-  debugger_t *debugger = 0;
+  insert_null_cartridge(gb);
 
   /* start the main loop */
-  clock_t start_t = clock();
+  frame_pacer_t pacer;
+  frame_pacer_start(&pacer, gb->speed);
+  bool paced_by_display = gb->vsync && gb->speed == 1.0;
 
 #ifdef DEBUG
-  clock_t fps_t = start_t;
+  double fps_t = monotonic_seconds();
   uint32_t num_frames = 0;
 #endif
 
-  while (true) {
-    uint8_t cycles_spent = update_cpu_state(&gb->cpu, debugger);
+  uint32_t frames = 0;
+  double run_start = monotonic_seconds();
+  double report_t = run_start;
+  uint32_t report_frames = 0;
 
-    if (!ppu_update(gb->cpu.ppu, cycles_spent))
-      continue;
-
-    if (gb->joy_pad->handle_button_press(gb->joy_pad)) {
-      /* quit game */
+  while (run_frame(gb)) {
+    if (++frames == gb->frame_limit)
       break;
-    }
-
-    /* draw to screen*/
-    gb->display->show(gb->display);
 
-    wait_until_next_frame((double) (clock() - start_t) / CLOCKS_PER_SEC);
+    if (gb->turbo) {
+      /* no frame pacing, just report how fast we are */
+      double now = monotonic_seconds();
+      ++report_frames;
+      if (now - report_t >= 1.0) {
+        char message[64];
+        snprintf(message, sizeof(message), "FPS: %d",
+                 (int) (report_frames / (now - report_t)));
+        logging_message(message);
+        report_frames = 0;
+        report_t = now;
+      }
+      continue;
+    }
 
-    clock_t now = clock();
+    if (!paced_by_display)
+      frame_pacer_wait(&pacer);
 
 #ifdef DEBUG
     ++num_frames;
-    double time_passed = (now - fps_t) / CLOCKS_PER_SEC;
+    double now = monotonic_seconds();
+    double time_passed = now - fps_t;
     if (time_passed > 0.25 && num_frames > 10) {
-      fprintf(stderr, "FPS: %d\n", (int)((double)num_frames / time_passed));
+      fprintf(stderr, "FPS: %.2f\n", num_frames / time_passed);
       num_frames = 0;
       fps_t = now;
     }
 #endif
+  }
 
-    start_t = now;
+  if (gb->turbo) {
+    double seconds = monotonic_seconds() - run_start;
+    char message[128];
+    snprintf(message, sizeof(message),
+             "Ran %u frames in %.2f seconds (%.1f FPS).", frames, seconds,
+             seconds > 0 ? frames / seconds : 0.0);
+    logging_message(message);
   }
 }
 
-static void wait_until_next_frame(double time_spent) {
-  static const unsigned frame_rate = 60;
-  time_spent = fmax((1.0 / frame_rate) - time_spent, 0);
-  usleep((useconds_t) (time_spent * 1000000));
+static double monotonic_seconds(void) {
+  return frame_pacer_now() / 1e9;
 }
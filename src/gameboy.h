@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 struct game_boy_t;
 typedef struct game_boy_t *gb_t;
@@ -17,4 +19,34 @@ game_boy_insert_game(gb_t gb, const char *game_path, const char *save_file);
 
 void game_boy_run(gb_t gb);
 
+bool game_boy_run_frames(gb_t gb, uint32_t frames);
+
+void game_boy_set_turbo(gb_t gb, bool turbo);
+
+void game_boy_set_frame_limit(gb_t gb, uint32_t frames);
+
+void game_boy_set_frame_skip(gb_t gb, uint32_t interval);
+
+void game_boy_set_vsync(gb_t gb, bool vsync);
+
+void game_boy_set_speed(gb_t gb, double speed);
+
+void game_boy_set_memory_timing(gb_t gb, bool enabled);
+
+void game_boy_map_save_file(gb_t gb, uint32_t sync_interval);
+
 void game_boy_entry_after_boot(gb_t gb);
+
+uint64_t game_boy_cycles(gb_t gb);
+
+uint64_t game_boy_instructions(gb_t gb);
+
+size_t game_boy_state_size(gb_t gb);
+
+bool game_boy_save_state(gb_t gb, void *buffer, size_t size);
+
+bool game_boy_load_state(gb_t gb, const void *buffer, size_t size);
+
+bool game_boy_set_rewind(gb_t gb, size_t capacity);
+
+uint32_t game_boy_rewind(gb_t gb, uint32_t frames);
@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <video/display.h>
+#include <video/framebuffer_display.h>
+#include <input/null_input.h>
+
+#include "gameboy_batch.h"
+#include "logging.h"
+
+typedef struct game_boy_batch {
+  size_t num_instances;
+  gb_t *instances;
+  display_t **displays;
+  /* num_instances framebuffers, one after another */
+  uint8_t *framebuffers;
+
+  size_t num_workers;
+  pthread_t *workers;
+
+  /* everything below is protected by the lock */
+  pthread_mutex_t lock;
+  pthread_cond_t work_available;
+  pthread_cond_t work_done;
+  /* incremented for every call to game_boy_batch_run */
+  uint64_t generation;
+  uint32_t frames;
+  /* the next instance that is not picked up by a thread yet */
+  size_t next_instance;
+  size_t finished_instances;
+  bool shutdown;
+} game_boy_batch_t;
+
+/* Picks up instances and runs them until none is left. Call with the lock. */
+static void run_instances(game_boy_batch_t *batch) {
+  while (batch->next_instance < batch->num_instances) {
+    gb_t gb = batch->instances[batch->next_instance++];
+    uint32_t frames = batch->frames;
+
+    pthread_mutex_unlock(&batch->lock);
+    game_boy_run_frames(gb, frames);
+    pthread_mutex_lock(&batch->lock);
+
+    if (++batch->finished_instances == batch->num_instances)
+      pthread_cond_signal(&batch->work_done);
+  }
+}
+
+static void *worker_main(void *arg) {
+  game_boy_batch_t *batch = (game_boy_batch_t *) arg;
+  uint64_t generation = 0;
+
+  pthread_mutex_lock(&batch->lock);
+  while (true) {
+    while (!batch->shutdown && batch->generation == generation)
+      pthread_cond_wait(&batch->work_available, &batch->lock);
+
+    if (batch->shutdown)
+      break;
+
+    generation = batch->generation;
+    run_instances(batch);
+  }
+  pthread_mutex_unlock(&batch->lock);
+
+  return 0;
+}
+
+static void stop_workers(game_boy_batch_t *batch, size_t num_workers) {
+  pthread_mutex_lock(&batch->lock);
+  batch->shutdown = true;
+  pthread_cond_broadcast(&batch->work_available);
+  pthread_mutex_unlock(&batch->lock);
+
+  for (size_t i = 0; i < num_workers; ++i)
+    pthread_join(batch->workers[i], 0);
+}
+
+/* Creates the next game boy of the batch. Returns false on failure. */
+static bool add_instance(game_boy_batch_t *batch) {
+  size_t index = batch->num_instances;
+  uint8_t *pixels = batch->framebuffers + index * FRAMEBUFFER_SIZE;
+
+  display_t *display = framebuffer_display_new(pixels);
+  if (!display)
+    return false;
+
+  input_strategy_t *input = null_joy_pad_new();
+  if (!input)
+    goto fail_input;
+
+  gb_t gb = game_boy_new(0, display, input);
+  if (!gb)
+    goto fail_game_boy;
+
+  game_boy_set_turbo(gb, true);
+
+  batch->instances[index] = gb;
+  batch->displays[index] = display;
+  ++batch->num_instances;
+  return true;
+
+  fail_game_boy:
+  input->delete(input);
+  fail_input:
+  display->delete(display);
+  return false;
+}
+
+/*
+ * Creates a batch of game boys without boot rom, display or input. They
+ * draw into the framebuffers of the batch instead. Insert games with
+ * game_boy_insert_game() on the instances returned by game_boy_batch_get().
+ * Returns NULL on failure.
+ * .num_instances   The number of game boys.
+ * .num_threads     The number of worker threads. The calling thread of
+ *                  game_boy_batch_run() runs instances as well, so 0 runs
+ *                  everything on the calling thread.
+ */
+gb_batch_t game_boy_batch_new(size_t num_instances, size_t num_threads) {
+  game_boy_batch_t *batch = calloc(1, sizeof(game_boy_batch_t));
+  if (!batch) {
+    logging_std_error();
+    return 0;
+  }
+
+  pthread_mutex_init(&batch->lock, 0);
+  pthread_cond_init(&batch->work_available, 0);
+  pthread_cond_init(&batch->work_done, 0);
+
+  batch->instances = calloc(num_instances, sizeof(gb_t));
+  batch->displays = calloc(num_instances, sizeof(display_t *));
+  batch->framebuffers = calloc(num_instances, FRAMEBUFFER_SIZE);
+  batch->workers = calloc(num_threads, sizeof(pthread_t));
+  if (!batch->instances || !batch->displays || !batch->framebuffers
+      || (num_threads && !batch->workers)) {
+    logging_std_error();
+    goto fail;
+  }
+
+  for (size_t i = 0; i < num_instances; ++i) {
+    if (!add_instance(batch))
+      goto fail;
+  }
+
+  for (; batch->num_workers < num_threads; ++batch->num_workers) {
+    if (pthread_create(&batch->workers[batch->num_workers], 0, worker_main,
+                       batch)) {
+      logging_error("Could not create worker thread.");
+      goto fail;
+    }
+  }
+
+  return batch;
+
+  fail:
+  game_boy_batch_delete(batch);
+  return 0;
+}
+
+void game_boy_batch_delete(gb_batch_t batch) {
+  stop_workers(batch, batch->num_workers);
+
+  for (size_t i = 0; i < batch->num_instances; ++i)
+    game_boy_delete(batch->instances[i]);
+  for (size_t i = 0; i < batch->num_instances; ++i)
+    batch->displays[i]->delete(batch->displays[i]);
+
+  pthread_cond_destroy(&batch->work_done);
+  pthread_cond_destroy(&batch->work_available);
+  pthread_mutex_destroy(&batch->lock);
+
+  free(batch->workers);
+  free(batch->framebuffers);
+  free(batch->displays);
+  free(batch->instances);
+  free(batch);
+}
+
+size_t game_boy_batch_size(gb_batch_t batch) {
+  return batch->num_instances;
+}
+
+gb_t game_boy_batch_get(gb_batch_t batch, size_t index) {
+  return index < batch->num_instances ? batch->instances[index] : 0;
+}
+
+/*
+ * Runs every game boy of the batch for the given amount of frames and
+ * returns when all of them are done.
+ * .frames      The number of frames each game boy runs.
+ */
+void game_boy_batch_run(gb_batch_t batch, uint32_t frames) {
+  pthread_mutex_lock(&batch->lock);
+
+  batch->frames = frames;
+  batch->next_instance = 0;
+  batch->finished_instances = 0;
+  ++batch->generation;
+  pthread_cond_broadcast(&batch->work_available);
+
+  run_instances(batch);
+
+  while (batch->finished_instances < batch->num_instances)
+    pthread_cond_wait(&batch->work_done, &batch->lock);
+
+  pthread_mutex_unlock(&batch->lock);
+}
+
+/*
+ * Returns the framebuffers of all game boys in one array. The framebuffer
+ * of instance i starts at i * FRAMEBUFFER_SIZE, see framebuffer_display.h.
+ * The content is valid until the next call to game_boy_batch_run().
+ */
+const uint8_t *game_boy_batch_framebuffers(gb_batch_t batch) {
+  return batch->framebuffers;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gameboy.h"
+
+/*
+ * Runs many independent game boys side by side on a pool of worker threads.
+ * Every game boy draws into its own part of one contiguous array of
+ * framebuffers.
+ */
+
+struct game_boy_batch;
+typedef struct game_boy_batch *gb_batch_t;
+
+gb_batch_t game_boy_batch_new(size_t num_instances, size_t num_threads);
+
+void game_boy_batch_delete(gb_batch_t batch);
+
+size_t game_boy_batch_size(gb_batch_t batch);
+
+gb_t game_boy_batch_get(gb_batch_t batch, size_t index);
+
+void game_boy_batch_run(gb_batch_t batch, uint32_t frames);
+
+const uint8_t *game_boy_batch_framebuffers(gb_batch_t batch);
@@ -0,0 +1,28 @@
+#include <stdlib.h>
+
+#include <logging.h>
+#include "null_input.h"
+
+/* An input strategy that never presses a button. Used when running
+ * headless, where nobody is there to play. */
+
+static bool handle_button_press(input_strategy_t *this) {
+  return false;
+}
+
+static void null_joy_pad_delete(input_strategy_t *this) {
+  free(this);
+}
+
+input_strategy_t *null_joy_pad_new(void) {
+  input_strategy_t *strategy = calloc(1, sizeof(input_strategy_t));
+  if (!strategy) {
+    logging_std_error();
+    return 0;
+  }
+
+  strategy->handle_button_press = handle_button_press;
+  strategy->delete = null_joy_pad_delete;
+
+  return strategy;
+}
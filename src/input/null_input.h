@@ -0,0 +1,5 @@
+#pragma once
+
+#include "input_strategy.h"
+
+input_strategy_t *null_joy_pad_new(void);
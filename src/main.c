@@ -5,7 +5,9 @@
 
 #include <SDL2/SDL.h>
 #include <video/sdl_display.h>
+#include <video/shm_display.h>
 #include <input/sdl_input.h>
+#include <input/null_input.h>
 
 #include "gameboy.h"
 #include "logging.h"
@@ -22,18 +24,37 @@ static struct {
   const char *boot_rom;
   const char *save_file;
   bool no_save;
+  bool map_save;
+  uint32_t sync_interval;
+  bool headless;
+  uint32_t frames;
+  uint32_t draw_interval;
+  const char *shared_memory;
+  int scale;
+  bool vsync;
+  double speed;
+  bool memory_timing;
 } set_options;
 
 static struct option options[] = {
-    {"help",     no_argument,       0, 'h'},
-    {"file",     required_argument, 0, 'f'},
-    {"boot_rom", required_argument, 0, 'b'},
-    {"save",     required_argument, 0, 's'},
-    {"no-save",  no_argument,       0, 'n'},
+    {"help",          no_argument,       0, 'h'},
+    {"file",          required_argument, 0, 'f'},
+    {"boot_rom",      required_argument, 0, 'b'},
+    {"save",          required_argument, 0, 's'},
+    {"no-save",       no_argument,       0, 'n'},
+    {"map-save",      required_argument, 0, 'M'},
+    {"headless",      no_argument,       0, 'H'},
+    {"frames",        required_argument, 0, 'F'},
+    {"draw-every",    required_argument, 0, 'D'},
+    {"shared-memory", required_argument, 0, 'm'},
+    {"scale",         required_argument, 0, 'S'},
+    {"vsync",         no_argument,       0, 'V'},
+    {"speed",         required_argument, 0, 'x'},
+    {"accurate",      no_argument,       0, 'a'},
     {NULL, 0, NULL,                    0},
 };
 
-static const char *option_string = "h:f:b:s:n";
+static const char *option_string = "h:f:b:s:nM:HF:D:m:S:Vx:a";
 
 static void usage(const char *program_name) {
   fprintf(stderr, "Usage: %s --file FILE [OPTIONS]\n", program_name);
@@ -43,9 +64,33 @@ static void usage(const char *program_name) {
   fprintf(stderr, "\t-b,--boot_rom FILE    Enable boot screen.\n");
   fprintf(stderr, "\t-s,--save FILE        Specify save game file.\n");
   fprintf(stderr, "\t-n,--no-save          No save game generation.\n");
+  fprintf(stderr, "\t-M,--map-save N       Map the save file as the "
+                  "cartridge ram, sync it every\n"
+                  "\t                      N seconds, 0 syncs only on "
+                  "exit.\n");
+  fprintf(stderr, "\t-H,--headless         Run without window as fast as "
+                  "possible.\n");
+  fprintf(stderr, "\t-F,--frames N         Quit after N frames.\n");
+  fprintf(stderr, "\t-D,--draw-every N     Draw only every Nth frame, 0 draws "
+                  "none.\n");
+  fprintf(stderr, "\t-m,--shared-memory NAME Draw into the POSIX shared "
+                  "memory NAME instead\n"
+                  "\t                      of a window.\n");
+  fprintf(stderr, "\t-S,--scale N          Scale the window by N (default "
+                  "4).\n");
+  fprintf(stderr, "\t-V,--vsync            Let the vertical sync of the "
+                  "screen pace the frames.\n");
+  fprintf(stderr, "\t-x,--speed X          Run X times as fast as a game "
+                  "boy, 0.5 to 8.\n");
+  fprintf(stderr, "\t-a,--accurate         Time every memory access "
+                  "exactly (slower).\n");
 }
 
 static int setup_options(int argc, char *argv[]) {
+  set_options.draw_interval = 1;
+  set_options.scale = 4;
+  set_options.speed = 1.0;
+
   /* parse command line options */
   char flg;
   while ((flg = getopt_long(argc, argv, option_string, options, 0)) != -1) {
@@ -65,6 +110,34 @@ static int setup_options(int argc, char *argv[]) {
       case 'n':
         set_options.no_save = true;
         break;
+      case 'M':
+        set_options.map_save = true;
+        set_options.sync_interval = (uint32_t) strtoul(optarg, 0, 10);
+        break;
+      case 'H':
+        set_options.headless = true;
+        break;
+      case 'F':
+        set_options.frames = (uint32_t) strtoul(optarg, 0, 10);
+        break;
+      case 'D':
+        set_options.draw_interval = (uint32_t) strtoul(optarg, 0, 10);
+        break;
+      case 'm':
+        set_options.shared_memory = strdup(optarg);
+        break;
+      case 'S':
+        set_options.scale = atoi(optarg);
+        break;
+      case 'V':
+        set_options.vsync = true;
+        break;
+      case 'x':
+        set_options.speed = strtod(optarg, 0);
+        break;
+      case 'a':
+        set_options.memory_timing = true;
+        break;
       case '?':
         return 1;
       default:
@@ -81,6 +154,7 @@ static void options_delete(void) {
   free((void *) set_options.file_name);
   free((void *) set_options.boot_rom);
   free((void *) set_options.save_file);
+  free((void *) set_options.shared_memory);
 }
 
 int main(int argc, char *argv[]) {
@@ -91,18 +165,33 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  /* Let's start up the visual interface */
-  if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0) {
-    logging_error(SDL_GetError());
-    return 1;
-  }
+  display_t *display = 0;
+  input_strategy_t *joy_pad = 0;
 
-  display_t *display = sdl_display_new();
-  if (!display) {
-    logging_error("Display could not be created.");
-    return 1;
+  if (set_options.shared_memory) {
+    display = shm_display_new(set_options.shared_memory);
+    if (!display) {
+      logging_error("Shared memory display could not be created.");
+      return 1;
+    }
+    joy_pad = null_joy_pad_new();
+  } else if (set_options.headless) {
+    joy_pad = null_joy_pad_new();
+  } else {
+    /* Let's start up the visual interface */
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0) {
+      logging_error(SDL_GetError());
+      return 1;
+    }
+
+    display = sdl_display_new(set_options.scale, set_options.vsync);
+    if (!display) {
+      logging_error("Display could not be created.");
+      return 1;
+    }
+    joy_pad = sdl_joy_pad_new();
   }
-  input_strategy_t *joy_pad = sdl_joy_pad_new();
+
   if (!joy_pad) {
     logging_error("Joy-pad could not be created.");
     return 1;
@@ -117,12 +206,21 @@ int main(int argc, char *argv[]) {
         "No save file specified, using 'default.save' as a fallback.");
   }
 
+  if (set_options.map_save)
+    game_boy_map_save_file(gb, set_options.sync_interval);
   game_boy_insert_game(gb, set_options.file_name, set_options.save_file);
+  game_boy_set_turbo(gb, set_options.headless);
+  game_boy_set_frame_limit(gb, set_options.frames);
+  game_boy_set_frame_skip(gb, set_options.draw_interval);
+  game_boy_set_speed(gb, set_options.speed);
+  game_boy_set_memory_timing(gb, set_options.memory_timing);
+  if (display && !set_options.shared_memory)
+    game_boy_set_vsync(gb, sdl_display_has_vsync(display));
   game_boy_run(gb);
 
   /* Clean everything up */
   game_boy_delete(gb);
-  display->delete(display);
+  if (display) display->delete(display);
   options_delete();
   return 0;
 }
@@ -5,16 +5,11 @@
 #include <stdio.h>
 
 #include "memory_handler.h"
-
-static uint8_t bootupcode[256];
-
-void load_boot_rom(FILE *stream) {
-  fread(bootupcode, 1, sizeof(bootupcode), stream);
-}
+#include <save_state.h>
 
 static uint8_t __mmu_read(mmu_t *mmu, gb_address_t address);
 
-static uint8_t mmu_boot_read(mmu_t *mmu, gb_address_t address);
+static void mmu_disable_boot_rom(mmu_t *mmu);
 
 uint8_t mmu_read(mmu_t *mmu, gb_address_t address);
 
@@ -28,6 +23,9 @@ typedef struct mmu_handler {
 #define MMU_MAX_HANDLE 32
 #define MMU_START_HANDLE 1
 
+#define MMU_PAGE_SIZE 256
+#define MMU_NUM_PAGES 256
+
 struct __memory_handling {
   /* handling addresses from 0x0000 to 0x7FFF */
   mem_handler_t *ROM_handler;
@@ -44,6 +42,23 @@ struct __memory_handling {
   as_handle_t high_mem_handles[512];
   as_handle_t current_handle;
   mem_handler_t *memory_handlers[MMU_MAX_HANDLE];
+
+  /* Direct host pointers for every page of the address space. Accesses to
+   * a page without a pointer (NULL) go through the memory handlers. */
+  uint8_t *read_pages[MMU_NUM_PAGES];
+  uint8_t *write_pages[MMU_NUM_PAGES];
+
+  /* incremented whenever a page gets mapped to other memory for reading */
+  uint32_t mapping_generation;
+
+  /* Directly writable pages that contain code. Writes to them are reported
+   * to the code write listener, so decoded code can be invalidated. */
+  uint8_t *watched_pages[MMU_NUM_PAGES];
+  /* Pages written through the memory handlers that contain code, e.g. a
+   * bank of the cartridge ram. They stay watched across bank switches. */
+  bool code_pages[MMU_NUM_PAGES];
+  code_write_t code_write_listener;
+  void *code_write_context;
 };
 
 typedef struct memory_management_unit {
@@ -52,27 +67,154 @@ typedef struct memory_management_unit {
 
   struct __memory_handling address_space;
 
-  uint8_t *booting_done;
-
-  uint8_t (*read)(mmu_t *, gb_address_t);
+  /* while booting, page 0 is overlaid by the boot rom and the page that
+   * was mapped there is kept here */
+  bool booting;
+  uint8_t *boot_shadowed_page;
+  uint8_t boot_rom[256];
 
   mmu_handler_t internal_mem_handler;
 } mmu_t;
 
+static void mmu_set_read_page(mmu_t *mmu, uint8_t page, uint8_t *memory) {
+  if (page == 0 && mmu->booting) {
+    mmu->boot_shadowed_page = memory;
+    return;
+  }
+
+  if (mmu->address_space.read_pages[page] != memory)
+    ++mmu->address_space.mapping_generation;
+  mmu->address_space.read_pages[page] = memory;
+}
+
+/*
+ * Maps the address range [start, end] directly to host memory, so reads
+ * and/or writes do not need to call the memory handler.
+ * The range has to be page aligned.
+ * .memory      The host memory backing the address 'start'.
+ * .access      MMU_DIRECT_READ, MMU_DIRECT_WRITE or both.
+ */
+void mmu_map_direct_memory(mmu_t *mmu, gb_address_t start, gb_address_t end,
+                           uint8_t *memory, uint8_t access) {
+  assert((start & 0xFF) == 0 && (end & 0xFF) == 0xFF);
+  assert(start <= end);
+
+  struct __memory_handling *as = &mmu->address_space;
+  int first = start >> 8, last = end >> 8;
+
+  /* bank switches remap whole banks, keep this loop tight */
+  if (access & MMU_DIRECT_READ) {
+    int page = first;
+    if (page == 0 && mmu->booting) {
+      /* the boot rom stays on top until it is disabled */
+      mmu->boot_shadowed_page = memory;
+      ++page;
+    }
+
+    for (; page <= last; ++page)
+      as->read_pages[page] = memory + ((page - first) << 8);
+    ++as->mapping_generation;
+  }
+
+  if (access & MMU_DIRECT_WRITE) {
+    for (int page = first; page <= last; ++page) {
+      as->write_pages[page] = memory + ((page - first) << 8);
+      as->watched_pages[page] = 0;
+    }
+  }
+}
+
+/* Routes all accesses to [start, end] through the memory handlers again. */
+void mmu_unmap_direct_memory(mmu_t *mmu, gb_address_t start,
+                             gb_address_t end) {
+  for (int page = start >> 8; page <= end >> 8; ++page) {
+    mmu_set_read_page(mmu, (uint8_t) page, 0);
+    mmu->address_space.write_pages[page] = 0;
+    mmu->address_space.watched_pages[page] = 0;
+  }
+}
+
+void mmu_set_code_write_listener(mmu_t *mmu, code_write_t listener,
+                                 void *context) {
+  mmu->address_space.code_write_listener = listener;
+  mmu->address_space.code_write_context = context;
+}
+
+/*
+ * Has to be called by memory handlers that write to directly readable
+ * memory, which may contain code.
+ */
+void mmu_report_write(mmu_t *mmu, gb_address_t address) {
+  if (mmu->address_space.code_write_listener)
+    mmu->address_space.code_write_listener(
+        mmu->address_space.code_write_context, address);
+}
+
+/*
+ * Reports writes to the page of 'address' to the code write listener.
+ * Pages mirroring the same memory (echo ram) are watched as well.
+ * Writes to the rom only switch banks, they are never reported.
+ */
+void mmu_watch_writes(mmu_t *mmu, gb_address_t address) {
+  struct __memory_handling *as = &mmu->address_space;
+  uint8_t *memory = as->write_pages[address >> 8];
+  if (!memory) {
+    if (address >= 0x8000)
+      as->code_pages[address >> 8] = true;
+    return;
+  }
+
+  for (int page = 0; page < MMU_NUM_PAGES; ++page) {
+    if (as->write_pages[page] != memory) continue;
+    as->watched_pages[page] = memory;
+    as->write_pages[page] = 0;
+  }
+}
+
+/* Undoes mmu_watch_writes(). */
+void mmu_unwatch_writes(mmu_t *mmu, gb_address_t address) {
+  struct __memory_handling *as = &mmu->address_space;
+  as->code_pages[address >> 8] = false;
+
+  uint8_t *memory = as->watched_pages[address >> 8];
+  if (!memory) return;
+
+  for (int page = 0; page < MMU_NUM_PAGES; ++page) {
+    if (as->watched_pages[page] != memory) continue;
+    as->write_pages[page] = memory;
+    as->watched_pages[page] = 0;
+  }
+}
+
+/* Returns the host memory 'address' is directly mapped to, or NULL. */
+uint8_t *mmu_get_direct_read_pointer(mmu_t *mmu, gb_address_t address) {
+  uint8_t *page = mmu->address_space.read_pages[address >> 8];
+  return page ? page + (address & 0xFF) : 0;
+}
+
+const uint32_t *mmu_get_mapping_generation(mmu_t *mmu) {
+  return &mmu->address_space.mapping_generation;
+}
+
 void mmu_assign_rom_handler(mmu_t *mmu, mem_handler_t *handler) {
   mmu->address_space.ROM_handler = handler;
+  mmu_unmap_direct_memory(mmu, 0x0000, 0x7FFF);
 }
 
 void mmu_assign_wram_handler(mmu_t *mmu, mem_handler_t *handler) {
   mmu->address_space.WRAM_handler = handler;
+  /* the echo ram mirrors the wram */
+  mmu_unmap_direct_memory(mmu, 0xC000, 0xFDFF);
 }
 
 void mmu_assign_vram_handler(mmu_t *mmu, mem_handler_t *handler) {
   mmu->address_space.VRAM_handler = handler;
+  mmu_unmap_direct_memory(mmu, 0x8000, 0x9FFF);
 }
 
 void mmu_assign_extram_handler(mmu_t *mmu, mem_handler_t *handler) {
   mmu->address_space.extRAM_handler = handler;
+  mmu_unmap_direct_memory(mmu, 0xA000, 0xBFFF);
 }
 
 static DEF_MEM_READ(echo_read) {
@@ -154,6 +296,9 @@ static DEF_MEM_WRITE(internal_write) {
       /* write to DIV */
       value = 0;
     }
+
+    if (address == 0xFF50 && value && mmu->booting)
+      mmu_disable_boot_rom(mmu);
     mmu->high_memory[address - 0xFE00] = value;
     return;
   }
@@ -199,8 +344,6 @@ mmu_t *mmu_new(void) {
   mmu_t *mmu = calloc(1, sizeof(mmu_t));
   if (!mmu) return 0;
 
-  mmu->read = __mmu_read;
-  mmu->booting_done = mmu->high_memory + 0x150;
   mmu->address_space.current_handle = MMU_START_HANDLE;
 
   /* setup internal memory handler */
@@ -209,6 +352,12 @@ mmu_t *mmu_new(void) {
   mem_handler_t *handler = (mem_handler_t *) &mmu->internal_mem_handler;
   mmu_assign_wram_handler(mmu, handler);
 
+  /* wram and its echo are plain memory */
+  mmu_map_direct_memory(mmu, 0xC000, 0xDFFF, mmu->internal_ram,
+                        MMU_DIRECT_READ | MMU_DIRECT_WRITE);
+  mmu_map_direct_memory(mmu, 0xE000, 0xFDFF, mmu->internal_ram,
+                        MMU_DIRECT_READ | MMU_DIRECT_WRITE);
+
   mem_tuple_t tuple = mmu_map_memory(mmu, 0xFE00, 0xFFFF);
   mmu_register_mem_handler(mmu, handler, tuple.handle);
 
@@ -270,27 +419,74 @@ static uint8_t __mmu_read(mmu_t *mmu, gb_address_t address) {
   return handler->read(handler, address);
 }
 
-static uint8_t mmu_boot_read(mmu_t *mmu, gb_address_t address) {
-  if (*mmu->booting_done)
-    /* disable boot */
-    mmu->read = __mmu_read;
-
-  if (address < 0x100) return bootupcode[address];
+uint8_t mmu_read(mmu_t *mmu, gb_address_t address) {
+  uint8_t *page = mmu->address_space.read_pages[address >> 8];
+  if (page) return page[address & 0xFF];
 
   return __mmu_read(mmu, address);
 }
 
-uint8_t mmu_read(mmu_t *mmu, gb_address_t address) {
-  return mmu->read(mmu, address);
-}
-
 void mmu_write(mmu_t *mmu, gb_address_t address, uint8_t value) {
+  uint8_t *page = mmu->address_space.write_pages[address >> 8];
+  if (page) {
+    page[address & 0xFF] = value;
+    return;
+  }
+
+  page = mmu->address_space.watched_pages[address >> 8];
+  if (page) {
+    page[address & 0xFF] = value;
+    mmu->address_space.code_write_listener(
+        mmu->address_space.code_write_context, address);
+    return;
+  }
+
   mem_handler_t *handler = mmu_get_mem_handler(mmu, address);
   handler->write(handler, address, value);
+
+  if (mmu->address_space.code_pages[address >> 8])
+    mmu_report_write(mmu, address);
+}
+
+void load_boot_rom(mmu_t *mmu, FILE *stream) {
+  fread(mmu->boot_rom, 1, sizeof(mmu->boot_rom), stream);
 }
 
 void enable_boot_rom(mmu_t *mmu) {
-  mmu->read = mmu_boot_read;
+  /* the boot rom is exactly one page large */
+  mmu->boot_shadowed_page = mmu->address_space.read_pages[0];
+  mmu_set_read_page(mmu, 0, mmu->boot_rom);
+  mmu->booting = true;
+}
+
+static void mmu_disable_boot_rom(mmu_t *mmu) {
+  mmu->booting = false;
+  mmu_set_read_page(mmu, 0, mmu->boot_shadowed_page);
+}
+
+/*
+ * Writes the internal ram, the high memory (which contains the registers of
+ * all other components) and the boot rom state.
+ */
+void mmu_save_state(mmu_t *mmu, state_buffer_t *state) {
+  state_write_value(state, mmu->internal_ram);
+  state_write_value(state, mmu->high_memory);
+  state_write_value(state, mmu->boot_rom);
+  state_write_value(state, mmu->booting);
+}
+
+void mmu_load_state(mmu_t *mmu, state_buffer_t *state) {
+  bool booting;
+
+  state_read_value(state, mmu->internal_ram);
+  state_read_value(state, mmu->high_memory);
+  state_read_value(state, mmu->boot_rom);
+  state_read_value(state, booting);
+
+  if (booting && !mmu->booting)
+    enable_boot_rom(mmu);
+  else if (!booting && mmu->booting)
+    mmu_disable_boot_rom(mmu);
 }
 
 void mmu_clean(mmu_t *mmu) {
@@ -1,12 +1,14 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef struct memory_management_unit mmu_t;
 
 typedef uint16_t gb_address_t;
 typedef struct memory_handler mem_handler_t;
 typedef uint8_t as_handle_t;
+typedef struct state_buffer state_buffer_t;
 
 mmu_t *mmu_new(void);
 
@@ -14,6 +16,10 @@ void mmu_delete(mmu_t *mmu);
 
 void mmu_clean(mmu_t *mmu);
 
+void mmu_save_state(mmu_t *mmu, state_buffer_t *state);
+
+void mmu_load_state(mmu_t *mmu, state_buffer_t *state);
+
 typedef struct mem_tuple_t {
   uint8_t *memory;
   as_handle_t handle;
@@ -33,5 +39,28 @@ void mmu_assign_extram_handler(mmu_t *mmu, mem_handler_t *handler);
 
 void mmu_register_mem_handler(mmu_t *mmu, mem_handler_t *m, as_handle_t h);
 
+#define MMU_DIRECT_READ   1
+#define MMU_DIRECT_WRITE  2
+
+void mmu_map_direct_memory(mmu_t *mmu, gb_address_t start, gb_address_t end,
+                           uint8_t *memory, uint8_t access);
+
+void mmu_unmap_direct_memory(mmu_t *mmu, gb_address_t start, gb_address_t end);
+
+uint8_t *mmu_get_direct_read_pointer(mmu_t *mmu, gb_address_t address);
+
+const uint32_t *mmu_get_mapping_generation(mmu_t *mmu);
+
+typedef void (*code_write_t)(void *, gb_address_t);
+
+void mmu_set_code_write_listener(mmu_t *mmu, code_write_t listener,
+                                 void *context);
+
+void mmu_report_write(mmu_t *mmu, gb_address_t address);
+
+void mmu_watch_writes(mmu_t *mmu, gb_address_t address);
+
+void mmu_unwatch_writes(mmu_t *mmu, gb_address_t address);
+
 void mmu_dma_transfer(mmu_t *mmu, gb_address_t from, gb_address_t to);
 
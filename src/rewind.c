@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+#include "logging.h"
+
+/*
+ * Every delta in the ring is stored as
+ *    [ uint32 length | encoded xor | uint32 length ]
+ * so it can be removed from either end. The encoded xor is a sequence of
+ *    [ varint zeros | varint literals | literal bytes ]
+ * until the whole state is covered.
+ */
+
+/* literal runs end at the first run of this many unchanged bytes */
+#define MIN_ZERO_RUN 4
+
+typedef struct rewind_buffer {
+  /* the ring of deltas */
+  uint8_t *ring;
+  size_t capacity;
+  size_t head;
+  size_t tail;
+  size_t used;
+  size_t num_deltas;
+
+  /* the newest state and the one that is written next */
+  uint8_t *newest;
+  uint8_t *next;
+  bool has_newest;
+  size_t state_size;
+
+  /* the delta of the state pushed last, before it enters the ring */
+  uint8_t *encoded;
+} rewind_buffer_t;
+
+/*
+ * Creates a history that uses about 'capacity' bytes for the deltas.
+ * Returns NULL on failure.
+ */
+rewind_buffer_t *rewind_buffer_new(size_t capacity) {
+  rewind_buffer_t *this = calloc(1, sizeof(rewind_buffer_t));
+  if (!this) goto fail;
+
+  this->ring = malloc(capacity);
+  if (!this->ring) goto fail;
+
+  this->capacity = capacity;
+  return this;
+
+  fail:
+  logging_std_error();
+  free(this);
+  return 0;
+}
+
+void rewind_buffer_delete(rewind_buffer_t *this) {
+  free(this->encoded);
+  free(this->next);
+  free(this->newest);
+  free(this->ring);
+  free(this);
+}
+
+static void clear_history(rewind_buffer_t *this) {
+  this->head = this->tail = this->used = 0;
+  this->num_deltas = 0;
+}
+
+/*
+ * Returns the memory the next state has to be written to before calling
+ * rewind_buffer_push(). If the size differs from the one of the previous
+ * states, the history is dropped. Returns NULL on failure.
+ */
+uint8_t *rewind_buffer_next(rewind_buffer_t *this, size_t size) {
+  if (size == this->state_size)
+    return this->next;
+
+  clear_history(this);
+  this->has_newest = false;
+  this->state_size = 0;
+
+  free(this->encoded);
+  free(this->next);
+  free(this->newest);
+
+  /* the encoding never grows the state by more than this */
+  size_t max_encoded = size + (size / MIN_ZERO_RUN + 1) * 10;
+
+  this->newest = malloc(size);
+  this->next = malloc(size);
+  this->encoded = malloc(max_encoded);
+  if (!this->newest || !this->next || !this->encoded) {
+    logging_std_error();
+    free(this->encoded);
+    free(this->next);
+    free(this->newest);
+    this->encoded = this->next = this->newest = 0;
+    return 0;
+  }
+
+  this->state_size = size;
+  return this->next;
+}
+
+static uint8_t *write_varint(uint8_t *out, size_t value) {
+  while (value >= 0x80) {
+    *out++ = (uint8_t) (value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (uint8_t) value;
+  return out;
+}
+
+static const uint8_t *read_varint(const uint8_t *in, size_t *value) {
+  size_t result = 0;
+  int shift = 0;
+  do {
+    result |= (size_t) (*in & 0x7F) << shift;
+    shift += 7;
+  } while (*in++ & 0x80);
+  *value = result;
+  return in;
+}
+
+/* counts the bytes from 'i' on that are equal in both states */
+static size_t equal_bytes(const uint8_t *a, const uint8_t *b, size_t i,
+                          size_t size) {
+  size_t start = i;
+
+  while (i + 8 <= size) {
+    uint64_t x, y;
+    memcpy(&x, a + i, 8);
+    memcpy(&y, b + i, 8);
+    if (x != y) break;
+    i += 8;
+  }
+
+  while (i < size && a[i] == b[i])
+    ++i;
+
+  return i - start;
+}
+
+/* Encodes the xor of both states, returns the length of the encoding. */
+static size_t encode_delta(const uint8_t *a, const uint8_t *b, size_t size,
+                           uint8_t *out) {
+  uint8_t *start = out;
+  size_t i = 0;
+
+  while (i < size) {
+    size_t zeros = equal_bytes(a, b, i, size);
+    i += zeros;
+
+    size_t literals = 0;
+    while (i + literals < size) {
+      if (a[i + literals] == b[i + literals]
+          && equal_bytes(a, b, i + literals, size) >= MIN_ZERO_RUN)
+        break;
+      ++literals;
+    }
+
+    out = write_varint(out, zeros);
+    out = write_varint(out, literals);
+    for (size_t j = 0; j < literals; ++j)
+      *out++ = a[i + j] ^ b[i + j];
+    i += literals;
+  }
+
+  return (size_t) (out - start);
+}
+
+static void apply_delta(uint8_t *state, const uint8_t *in, size_t size) {
+  size_t i = 0;
+
+  while (i < size) {
+    size_t zeros, literals;
+    in = read_varint(in, &zeros);
+    in = read_varint(in, &literals);
+    i += zeros;
+
+    for (size_t j = 0; j < literals; ++j)
+      state[i + j] ^= *in++;
+    i += literals;
+  }
+}
+
+static void ring_write(rewind_buffer_t *this, const void *data, size_t size) {
+  size_t first = this->capacity - this->head;
+  if (first > size) first = size;
+
+  memcpy(this->ring + this->head, data, first);
+  memcpy(this->ring, (const uint8_t *) data + first, size - first);
+
+  this->head = (this->head + size) % this->capacity;
+  this->used += size;
+}
+
+static void ring_read(rewind_buffer_t *this, size_t position, void *data,
+                      size_t size) {
+  position %= this->capacity;
+  size_t first = this->capacity - position;
+  if (first > size) first = size;
+
+  memcpy(data, this->ring + position, first);
+  memcpy((uint8_t *) data + first, this->ring, size - first);
+}
+
+static void drop_oldest(rewind_buffer_t *this) {
+  uint32_t length;
+  ring_read(this, this->tail, &length, sizeof(length));
+
+  size_t entry_size = length + 2 * sizeof(length);
+  this->tail = (this->tail + entry_size) % this->capacity;
+  this->used -= entry_size;
+  --this->num_deltas;
+}
+
+/*
+ * Makes the state written to rewind_buffer_next() the newest one. This
+ * takes time linear in the size of a state, independent of the length of
+ * the history.
+ */
+void rewind_buffer_push(rewind_buffer_t *this) {
+  uint8_t *state = this->next;
+
+  if (this->has_newest) {
+    uint32_t length = (uint32_t) encode_delta(this->newest, state,
+                                              this->state_size, this->encoded);
+    size_t entry_size = length + 2 * sizeof(length);
+
+    if (entry_size > this->capacity) {
+      clear_history(this);
+    } else {
+      while (this->capacity - this->used < entry_size)
+        drop_oldest(this);
+
+      ring_write(this, &length, sizeof(length));
+      ring_write(this, this->encoded, length);
+      ring_write(this, &length, sizeof(length));
+      ++this->num_deltas;
+    }
+  }
+
+  this->next = this->newest;
+  this->newest = state;
+  this->has_newest = true;
+}
+
+/*
+ * Drops the newest state, the one before becomes the newest. Returns false
+ * if there is no older state.
+ */
+bool rewind_buffer_pop(rewind_buffer_t *this) {
+  if (!this->num_deltas)
+    return false;
+
+  uint32_t length;
+  size_t end = this->head + this->capacity;
+  ring_read(this, end - sizeof(length), &length, sizeof(length));
+
+  size_t entry_size = length + 2 * sizeof(length);
+  size_t start = (end - entry_size) % this->capacity;
+
+  /* the encoding may wrap around the end of the ring */
+  ring_read(this, start + sizeof(length), this->encoded, length);
+  apply_delta(this->newest, this->encoded, this->state_size);
+
+  this->head = start;
+  this->used -= entry_size;
+  --this->num_deltas;
+  return true;
+}
+
+/* Returns the newest state or NULL if nothing has been pushed yet. */
+const uint8_t *rewind_buffer_newest(rewind_buffer_t *this) {
+  return this->has_newest ? this->newest : 0;
+}
+
+size_t rewind_buffer_state_size(rewind_buffer_t *this) {
+  return this->state_size;
+}
+
+/* Returns how many states older than the newest one are kept. */
+size_t rewind_buffer_length(rewind_buffer_t *this) {
+  return this->num_deltas;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Keeps a history of save states in a buffer of fixed size. Only the newest
+ * state is kept as it is, every older state is stored as the run length
+ * encoded xor of it and its successor. When the buffer is full, the oldest
+ * states are dropped.
+ */
+
+typedef struct rewind_buffer rewind_buffer_t;
+
+rewind_buffer_t *rewind_buffer_new(size_t capacity);
+
+void rewind_buffer_delete(rewind_buffer_t *this);
+
+uint8_t *rewind_buffer_next(rewind_buffer_t *this, size_t size);
+
+void rewind_buffer_push(rewind_buffer_t *this);
+
+bool rewind_buffer_pop(rewind_buffer_t *this);
+
+const uint8_t *rewind_buffer_newest(rewind_buffer_t *this);
+
+size_t rewind_buffer_state_size(rewind_buffer_t *this);
+
+size_t rewind_buffer_length(rewind_buffer_t *this);
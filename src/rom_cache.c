@@ -0,0 +1,175 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rom_cache.h"
+#include "logging.h"
+
+typedef struct cached_rom cached_rom_t;
+typedef struct cached_rom {
+  dev_t device;
+  ino_t inode;
+  /* the file was replaced if one of these changed */
+  off_t file_size;
+  struct timespec modified;
+
+  const uint8_t *data;
+  size_t size;
+  /* mapped from the file, else allocated and never shared */
+  bool mapped;
+  unsigned int references;
+
+  cached_rom_t *next;
+} cached_rom_t;
+
+static cached_rom_t *roms;
+static pthread_mutex_t roms_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool same_file(const cached_rom_t *rom, const struct stat *status) {
+  return rom->mapped && rom->device == status->st_dev &&
+         rom->inode == status->st_ino && rom->file_size == status->st_size &&
+         rom->modified.tv_sec == status->st_mtim.tv_sec &&
+         rom->modified.tv_nsec == status->st_mtim.tv_nsec;
+}
+
+static cached_rom_t *find_rom(const struct stat *status) {
+  for (cached_rom_t *rom = roms; rom; rom = rom->next) {
+    if (same_file(rom, status))
+      return rom;
+  }
+  return 0;
+}
+
+static void add_rom(cached_rom_t *rom) {
+  rom->references = 1;
+  rom->next = roms;
+  roms = rom;
+}
+
+static cached_rom_t *map_rom(int fd, const struct stat *status) {
+  cached_rom_t *rom = calloc(1, sizeof(cached_rom_t));
+  if (!rom) return 0;
+
+  void *memory = mmap(0, status->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (memory == MAP_FAILED) {
+    free(rom);
+    return 0;
+  }
+
+  rom->data = memory;
+  rom->size = status->st_size;
+  rom->mapped = true;
+  rom->device = status->st_dev;
+  rom->inode = status->st_ino;
+  rom->file_size = status->st_size;
+  rom->modified = status->st_mtim;
+  return rom;
+}
+
+/* Reads the whole file, for files that cannot be mapped. */
+static cached_rom_t *read_rom(int fd) {
+  size_t capacity = 0x8000;
+  size_t used = 0;
+  uint8_t *memory = 0;
+
+  cached_rom_t *rom = calloc(1, sizeof(cached_rom_t));
+  if (!rom) goto fail;
+
+  memory = malloc(capacity);
+  if (!memory) goto fail;
+
+  ssize_t count;
+  while ((count = read(fd, memory + used, capacity - used)) != 0) {
+    if (count < 0) goto fail;
+
+    used += count;
+    if (used == capacity) {
+      capacity *= 2;
+      uint8_t *larger = realloc(memory, capacity);
+      if (!larger) goto fail;
+      memory = larger;
+    }
+  }
+
+  rom->data = memory;
+  rom->size = used;
+  return rom;
+
+fail:
+  free(memory);
+  free(rom);
+  return 0;
+}
+
+/*
+ * Returns the content of the rom file, which must not be changed, or NULL
+ * if it could not be read. Every rom has to be given back with
+ * rom_cache_release().
+ * .size        Receives the size of the rom in bytes.
+ */
+const uint8_t *rom_cache_acquire(const char *path, size_t *size) {
+  cached_rom_t *rom = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) goto fail;
+
+  struct stat status;
+  if (fstat(fd, &status) < 0) goto fail;
+
+  if (S_ISREG(status.st_mode) && status.st_size > 0) {
+    pthread_mutex_lock(&roms_lock);
+    rom = find_rom(&status);
+    if (rom)
+      ++rom->references;
+    else if ((rom = map_rom(fd, &status)))
+      add_rom(rom);
+    pthread_mutex_unlock(&roms_lock);
+  }
+
+  /* e.g. a pipe, or a file that could not be mapped */
+  if (!rom) {
+    rom = read_rom(fd);
+    if (!rom) goto fail;
+
+    pthread_mutex_lock(&roms_lock);
+    add_rom(rom);
+    pthread_mutex_unlock(&roms_lock);
+  }
+
+  close(fd);
+  *size = rom->size;
+  return rom->data;
+
+fail:
+  logging_std_error();
+  if (fd >= 0) close(fd);
+  return 0;
+}
+
+/* Gives back a rom, it is unmapped when no one uses it anymore. */
+void rom_cache_release(const uint8_t *data) {
+  if (!data)
+    return;
+
+  pthread_mutex_lock(&roms_lock);
+
+  cached_rom_t **link = &roms;
+  while (*link && (*link)->data != data)
+    link = &(*link)->next;
+
+  cached_rom_t *rom = *link;
+  if (rom && !--rom->references) {
+    *link = rom->next;
+    if (rom->mapped)
+      munmap((void *) rom->data, rom->size);
+    else
+      free((void *) rom->data);
+    free(rom);
+  }
+
+  pthread_mutex_unlock(&roms_lock);
+}
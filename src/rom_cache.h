@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Keeps the roms that are in use, so every instance running the same game
+ * shares one copy. Regular files are mapped read only and identified by
+ * their device and inode, anything else (e.g. a pipe) is read into memory
+ * and never shared. The cache is safe to use from several threads.
+ */
+
+const uint8_t *rom_cache_acquire(const char *path, size_t *size);
+
+void rom_cache_release(const uint8_t *rom);
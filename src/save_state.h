@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The state of the machine is written to one flat buffer, component after
+ * component, in the byte order of the host. Whenever the layout changes,
+ * SAVE_STATE_VERSION has to be incremented.
+ */
+
+#define SAVE_STATE_MAGIC 0x4547414D /* "MAGE" */
+#define SAVE_STATE_VERSION 2
+
+typedef struct save_state_header {
+  uint32_t magic;
+  uint32_t version;
+  /* size of the whole state, including this header */
+  uint64_t size;
+} save_state_header_t;
+
+typedef struct state_buffer {
+  uint8_t *data;
+  size_t size;
+  size_t position;
+} state_buffer_t;
+
+/* Appends 'size' bytes. If there is no data, the bytes are only counted. */
+static inline void
+state_write(state_buffer_t *state, const void *value, size_t size) {
+  if (state->data && state->position + size <= state->size)
+    memcpy(state->data + state->position, value, size);
+  state->position += size;
+}
+
+static inline void state_read(state_buffer_t *state, void *value, size_t size) {
+  if (state->position + size <= state->size)
+    memcpy(value, state->data + state->position, size);
+  state->position += size;
+}
+
+#define state_write_value(state, value) \
+  state_write((state), &(value), sizeof(value))
+
+#define state_read_value(state, value) \
+  state_read((state), &(value), sizeof(value))
@@ -6,8 +6,7 @@
 
 #include <logging.h>
 
-static const int scale = 2;
-static uint8_t buffer[144 / scale + 1][160 / scale + 1];
+enum { scale = 2 };
 
 static const char *map = "@MkmCcj(]<;. ";
 
@@ -16,11 +15,13 @@ static const char *map = "@MkmCcj(]<;. ";
 typedef struct ascii_display {
   display_t base;
   int line_counter;
+  uint8_t buffer[144 / scale + 1][160 / scale + 1];
 } ascii_display_t;
 
 void ascii_display_show(display_t *this) {
-  printf("\e[1;1H\e[2J%s", (char*) buffer);
-  memset(buffer, 0, sizeof(buffer));
+  ascii_display_t *display = (ascii_display_t *)this;
+  printf("\e[1;1H\e[2J%s", (char*) display->buffer);
+  memset(display->buffer, 0, sizeof(display->buffer));
 }
 
 void ascii_display_draw_line(display_t *this, uint8_t *line) {
@@ -30,6 +31,7 @@ void ascii_display_draw_line(display_t *this, uint8_t *line) {
     display->line_counter = 0;
 
   int y = display->line_counter / scale;
+  uint8_t (*buffer)[160 / scale + 1] = display->buffer;
 
   for (int i = 0; i < 160; ++i)
     buffer[y][i / scale] += line[i];
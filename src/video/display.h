@@ -2,9 +2,21 @@
 
 #include <stdint.h>
 
+#define FRAMEBUFFER_WIDTH 160
+#define FRAMEBUFFER_HEIGHT 144
+#define FRAMEBUFFER_SIZE (FRAMEBUFFER_WIDTH * FRAMEBUFFER_HEIGHT)
+
+/*
+ * Pixels are one byte each, holding the shade (0-3). A display implements
+ * either draw_line, which is called for every line of a completed frame,
+ * or draw_frame, which gets the whole frame at once; the other is NULL.
+ */
 typedef struct display display_t;
 typedef struct display {
   void (*draw_line)(display_t *this, uint8_t *line);
   void (*show)(display_t *this);
   void (*delete)(display_t *this);
+  /* .frame_number  Counts all frames, including the ones not drawn. */
+  void (*draw_frame)(display_t *this, const uint8_t *pixels,
+                     uint64_t frame_number);
 } display_t ;
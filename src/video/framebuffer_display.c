@@ -0,0 +1,45 @@
+#include <stdlib.h>
+#include <string.h>
+#include "framebuffer_display.h"
+
+#include <logging.h>
+
+typedef struct framebuffer_display {
+  display_t base;
+  uint8_t *pixels;
+} framebuffer_display_t;
+
+static void framebuffer_display_show(display_t *this) {
+  /* the lines are already in place */
+}
+
+static void framebuffer_display_draw_frame(display_t *this,
+                                           const uint8_t *pixels,
+                                           uint64_t frame_number) {
+  framebuffer_display_t *display = (framebuffer_display_t *) this;
+  memcpy(display->pixels, pixels, FRAMEBUFFER_SIZE);
+}
+
+static void framebuffer_display_delete(display_t *display) {
+  free(display);
+}
+
+/*
+ * Creates a display that draws into memory owned by the caller. Every pixel
+ * is one byte holding the shade (0-3), the lines are stored top to bottom.
+ * .pixels      At least FRAMEBUFFER_SIZE bytes, has to outlive the display.
+ */
+display_t *framebuffer_display_new(uint8_t *pixels) {
+  framebuffer_display_t *display = calloc(1, sizeof(framebuffer_display_t));
+  if (!display) {
+    logging_std_error();
+    return 0;
+  }
+
+  display->base.show = framebuffer_display_show;
+  display->base.draw_frame = framebuffer_display_draw_frame;
+  display->base.delete = framebuffer_display_delete;
+  display->pixels = pixels;
+
+  return (display_t *) display;
+}
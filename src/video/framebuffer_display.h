@@ -0,0 +1,5 @@
+#pragma once
+
+#include "display.h"
+
+display_t *framebuffer_display_new(uint8_t *pixels);
@@ -1,6 +1,8 @@
 #include <assert.h>
+#include <string.h>
 #include "video.h"
 #include "iterator.h"
+#include "tile_cache.h"
 
 const uint16_t decoder[] = {
     0x0, 0x1, 0x4, 0x5, 0x10, 0x11, 0x14, 0x15,
@@ -45,50 +47,61 @@ uint16_t flip_line(uint16_t line) {
   return (uint16_t) (part_one | (part_two << 8));
 }
 
-static uint8_t get_tile_id_from_pixel(uint8_t *display, int px_x, int px_y);
-
-static void next_screen_pixel(camera_iterator_t *it);
+/*
+ * Draws the pixels 'from' to 'to' (exclusive) of one line of a tile map,
+ * looking up each tile row only once.
+ * .map         The tile map (32x32 tile ids).
+ * .map_x       The x coordinate in the map of the pixel at 'from'.
+ * .map_y       The y coordinate in the map of the line.
+ */
+static void draw_span(uint8_t *line, int from, int to, uint8_t *map,
+                      int map_x, int map_y, tile_cache_t *cache,
+                      find_tile_t find_tile, px_data_t *tiles) {
+  uint8_t *tile_ids = map + (map_y >> 3) * 32;
+  int tile_row = map_y & 7;
+
+  int x = from;
+  while (x < to) {
+    uint8_t tile_id = tile_ids[(map_x & 255) >> 3];
+    const uint8_t *pixels =
+        tile_cache_row(cache, find_tile(tile_id, tiles), tile_row);
+
+    /* the first and the last tile may be cut off */
+    int tile_col = map_x & 7;
+    int count = 8 - tile_col;
+    if (count > to - x) count = to - x;
+
+    memcpy(line + x, pixels + tile_col, count);
+    x += count;
+    map_x += count;
+  }
+}
 
-uint8_t next_pixel(camera_iterator_t *const it, find_tile_t find_tile,
-                   uint8_t *const palette) {
-  int display_pixel_x, display_pixel_y;
-  uint8_t *display;
+/*
+ * Draws the color indices of the next line of the background and the
+ * window. The window covers the background from its x position to the end
+ * of the line.
+ */
+void next_line(camera_iterator_t *const it, tile_cache_t *cache,
+               find_tile_t find_tile, uint8_t *line) {
+  int y = it->screen_pixel_y;
 
   /* window or not the window? this is the question.. */
-  if (it->window && it->screen_pixel_y >= it->window_y
-      && it->screen_pixel_x >= it->window_x - 8) {
-    display_pixel_x = it->screen_pixel_x;
-    display_pixel_y = it->screen_pixel_y - it->window_y;
-    display = it->window;
-  } else {
-    display_pixel_x = (it->screen_pixel_x + it->scroll_x) & 255;
-    display_pixel_y = (it->screen_pixel_y + it->scroll_y) & 255;
-    display = it->display;
+  int window_start = 160;
+  if (it->window && y >= it->window_y) {
+    window_start = it->window_x - 8;
+    if (window_start < 0) window_start = 0;
+    if (window_start > 160) window_start = 160;
   }
 
-  uint8_t tile_id = get_tile_id_from_pixel(display,
-                                           display_pixel_x,
-                                           display_pixel_y);
-  px_data_t *current_tile = find_tile(tile_id, it->tiles);
-
-  int tile_row = display_pixel_y & 7;
-  int tile_col = display_pixel_x & 7;
-
-  uint16_t tile_line = decode_tile_line(current_tile, tile_row);
-
-  int color_index = get_pixel(tile_line, tile_col);
-  uint8_t pixel = palette[color_index];
+  draw_span(line, 0, window_start, it->display, it->scroll_x,
+            (y + it->scroll_y) & 255, cache, find_tile, it->tiles);
 
-  next_screen_pixel(it);
+  draw_span(line, window_start, 160, it->window, window_start,
+            y - it->window_y, cache, find_tile, it->tiles);
 
-  return pixel;
-}
-
-/* returns the id of the tile, the iterator points to */
-static uint8_t get_tile_id_from_pixel(uint8_t *display, int px_x, int px_y) {
-  int x = px_x >> 3;
-  int y = px_y >> 3;
-  return *(display + y * 32 + x);
+  it->screen_pixel_x = 0;
+  ++it->screen_pixel_y;
 }
 
 px_data_t *find_tile_unsigned(uint8_t tile_id, px_data_t *const tiles) {
@@ -104,13 +117,6 @@ uint16_t decode_tile_line(px_data_t *const tile, int line) {
          decoder[tile->data[2 * line + 1]];
 }
 
-static void next_screen_pixel(camera_iterator_t *it) {
-  if (++it->screen_pixel_x >= 160) {
-    it->screen_pixel_x = 0;
-    ++it->screen_pixel_y;
-  }
-}
-
 camera_iterator_t reset_iterator(ppu_regs_t *const regs, uint8_t *const vram) {
   assert(vram);
 
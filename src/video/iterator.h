@@ -31,8 +31,10 @@ px_data_t *find_tile_unsigned(uint8_t tile_id, px_data_t *const tiles);
 
 px_data_t *find_tile_signed(uint8_t tile_id, px_data_t *const tiles);
 
-uint8_t next_pixel(camera_iterator_t *const it, find_tile_t find_tile,
-                   uint8_t *const palette);
+typedef struct tile_cache tile_cache_t;
+
+void next_line(camera_iterator_t *const it, tile_cache_t *cache,
+               find_tile_t find_tile, uint8_t *line);
 
 camera_iterator_t reset_iterator(ppu_regs_t *const regs, uint8_t *const vram);
 
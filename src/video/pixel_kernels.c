@@ -0,0 +1,194 @@
+#include <stdbool.h>
+#include "pixel_kernels.h"
+
+#ifdef HAVE_X86_PIXEL_KERNELS
+#include <immintrin.h>
+#endif
+
+static void scalar_decode_tile(const px_data_t *tile, uint8_t *pixels) {
+  for (int row = 0; row < 8; ++row) {
+    uint16_t line = decode_tile_line((px_data_t *) tile, row);
+    for (int col = 0; col < 8; ++col)
+      *pixels++ = get_pixel(line, col);
+  }
+}
+
+static void scalar_map_palette(uint8_t *line, const uint8_t *palette) {
+  for (int i = 0; i < LINE_WIDTH; ++i)
+    line[i] = palette[line[i]];
+}
+
+static void scalar_combine_lines(uint8_t *background, const uint8_t *sprites,
+                                 uint8_t zero_color) {
+  for (int i = 0; i < LINE_WIDTH; ++i) {
+    uint8_t sprite = sprites[i] & 3;
+    uint8_t visible = (sprites[i] >> 2) & 3;
+    bool priority = (sprites[i] & 0x80) != 0;
+
+    if (!visible)
+      continue;
+
+    if (priority && (background[i] != zero_color))
+      continue;
+
+    background[i] = sprite;
+  }
+}
+
+const pixel_kernels_t scalar_pixel_kernels = {
+    "scalar", scalar_decode_tile, scalar_map_palette, scalar_combine_lines
+};
+
+#ifdef HAVE_X86_PIXEL_KERNELS
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+/*
+ * Decodes two rows of a tile.
+ * .rows  The low bytes of both rows repeated 8 times in the 4 byte
+ *        lanes 0 and 2, the high bytes in the lanes 1 and 3.
+ */
+static inline SSE2 __m128i sse2_decode_rows(__m128i rows) {
+  /* the leftmost pixel is in the highest bit */
+  const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                                    1, 2, 4, 8, 16, 32, 64, -128);
+
+  __m128i low = _mm_shuffle_epi32(rows, _MM_SHUFFLE(2, 2, 0, 0));
+  __m128i high = _mm_shuffle_epi32(rows, _MM_SHUFFLE(3, 3, 1, 1));
+
+  /* the low byte is the high bit of the color index, see decode_tile_line */
+  low = _mm_cmpeq_epi8(_mm_and_si128(low, bits), bits);
+  high = _mm_cmpeq_epi8(_mm_and_si128(high, bits), bits);
+  return _mm_or_si128(_mm_and_si128(low, _mm_set1_epi8(2)),
+                      _mm_and_si128(high, _mm_set1_epi8(1)));
+}
+
+static SSE2 void sse2_decode_tile(const px_data_t *tile, uint8_t *pixels) {
+  __m128i data = _mm_loadu_si128((const __m128i *) tile->data);
+
+  /* repeat every byte 4 times: 4 rows per vector */
+  __m128i rows_0_3 = _mm_unpacklo_epi8(data, data);
+  __m128i rows_4_7 = _mm_unpackhi_epi8(data, data);
+
+  __m128i *out = (__m128i *) pixels;
+  _mm_storeu_si128(out + 0,
+                   sse2_decode_rows(_mm_unpacklo_epi16(rows_0_3, rows_0_3)));
+  _mm_storeu_si128(out + 1,
+                   sse2_decode_rows(_mm_unpackhi_epi16(rows_0_3, rows_0_3)));
+  _mm_storeu_si128(out + 2,
+                   sse2_decode_rows(_mm_unpacklo_epi16(rows_4_7, rows_4_7)));
+  _mm_storeu_si128(out + 3,
+                   sse2_decode_rows(_mm_unpackhi_epi16(rows_4_7, rows_4_7)));
+}
+
+/* sse2 has no byte shuffle, select the shade of every color instead */
+static SSE2 void sse2_map_palette(uint8_t *line, const uint8_t *palette) {
+  __m128i shades[4];
+  for (int i = 0; i < 4; ++i)
+    shades[i] = _mm_set1_epi8((char) palette[i]);
+
+  for (int i = 0; i < LINE_WIDTH; i += 16) {
+    __m128i colors = _mm_loadu_si128((const __m128i *) (line + i));
+    __m128i result = _mm_setzero_si128();
+    for (int color = 0; color < 4; ++color) {
+      __m128i is_color = _mm_cmpeq_epi8(colors, _mm_set1_epi8((char) color));
+      result = _mm_or_si128(result, _mm_and_si128(is_color, shades[color]));
+    }
+    _mm_storeu_si128((__m128i *) (line + i), result);
+  }
+}
+
+/* Combines 16 pixels, see combine_lines_t. */
+static inline SSE2 void sse2_combine_block(uint8_t *background,
+                                           const uint8_t *sprites,
+                                           __m128i bg_zero) {
+  const __m128i visible = _mm_set1_epi8(0x0C);
+  const __m128i priority = _mm_set1_epi8((char) 0x80);
+
+  __m128i bg = _mm_loadu_si128((const __m128i *) background);
+  __m128i sprite = _mm_loadu_si128((const __m128i *) sprites);
+
+  /* keep the background where no sprite is visible or it has priority */
+  __m128i hidden =
+      _mm_cmpeq_epi8(_mm_and_si128(sprite, visible), _mm_setzero_si128());
+  __m128i behind = _mm_andnot_si128(
+      _mm_cmpeq_epi8(bg, bg_zero),
+      _mm_cmpeq_epi8(_mm_and_si128(sprite, priority), priority));
+  __m128i keep = _mm_or_si128(hidden, behind);
+
+  __m128i result = _mm_or_si128(
+      _mm_and_si128(keep, bg),
+      _mm_andnot_si128(keep, _mm_and_si128(sprite, _mm_set1_epi8(3))));
+  _mm_storeu_si128((__m128i *) background, result);
+}
+
+static SSE2 void sse2_combine_lines(uint8_t *background,
+                                    const uint8_t *sprites,
+                                    uint8_t zero_color) {
+  __m128i bg_zero = _mm_set1_epi8((char) zero_color);
+  for (int i = 0; i < LINE_WIDTH; i += 16)
+    sse2_combine_block(background + i, sprites + i, bg_zero);
+}
+
+const pixel_kernels_t sse2_pixel_kernels = {
+    "sse2", sse2_decode_tile, sse2_map_palette, sse2_combine_lines
+};
+
+_Static_assert(LINE_WIDTH % 32 == 0, "avx2 kernels need whole vectors");
+
+static AVX2 void avx2_map_palette(uint8_t *line, const uint8_t *palette) {
+  uint8_t table[16] = {palette[0], palette[1], palette[2], palette[3]};
+  __m256i shades =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) table));
+
+  for (int i = 0; i < LINE_WIDTH; i += 32) {
+    __m256i colors = _mm256_loadu_si256((const __m256i *) (line + i));
+    _mm256_storeu_si256((__m256i *) (line + i),
+                        _mm256_shuffle_epi8(shades, colors));
+  }
+}
+
+static AVX2 void avx2_combine_lines(uint8_t *background,
+                                    const uint8_t *sprites,
+                                    uint8_t zero_color) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i visible = _mm256_set1_epi8(0x0C);
+  const __m256i priority = _mm256_set1_epi8((char) 0x80);
+  const __m256i color = _mm256_set1_epi8(3);
+  const __m256i bg_zero = _mm256_set1_epi8((char) zero_color);
+
+  for (int i = 0; i < LINE_WIDTH; i += 32) {
+    __m256i bg = _mm256_loadu_si256((const __m256i *) (background + i));
+    __m256i sprite = _mm256_loadu_si256((const __m256i *) (sprites + i));
+
+    __m256i hidden =
+        _mm256_cmpeq_epi8(_mm256_and_si256(sprite, visible), zero);
+    __m256i behind = _mm256_andnot_si256(
+        _mm256_cmpeq_epi8(bg, bg_zero),
+        _mm256_cmpeq_epi8(_mm256_and_si256(sprite, priority), priority));
+    __m256i keep = _mm256_or_si256(hidden, behind);
+
+    /* the background where keep is set, the sprite color elsewhere */
+    __m256i result = _mm256_blendv_epi8(_mm256_and_si256(sprite, color),
+                                        bg, keep);
+    _mm256_storeu_si256((__m256i *) (background + i), result);
+  }
+}
+
+const pixel_kernels_t avx2_pixel_kernels = {
+    "avx2", sse2_decode_tile, avx2_map_palette, avx2_combine_lines
+};
+
+#endif
+
+const pixel_kernels_t *pixel_kernels_select(void) {
+#ifdef HAVE_X86_PIXEL_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return &avx2_pixel_kernels;
+  if (__builtin_cpu_supports("sse2"))
+    return &sse2_pixel_kernels;
+#endif
+  return &scalar_pixel_kernels;
+}
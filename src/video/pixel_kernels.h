@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "video.h"
+#include "iterator.h"
+
+#define LINE_WIDTH 160
+
+/* Decodes the 8 rows of a tile to 64 color indices. */
+typedef void (*decode_tile_t)(const px_data_t *tile, uint8_t *pixels);
+
+/* Replaces the color indices of a line by the shades of the palette. */
+typedef void (*map_palette_t)(uint8_t *line, const uint8_t *palette);
+
+/*
+ * Draws the visible sprite pixels over the background line.
+ * .sprites     Per pixel: color | visibility << 2 | priority-bit.
+ * .zero_color  Background pixels of this shade are covered by sprites
+ *              with priority.
+ */
+typedef void (*combine_lines_t)(uint8_t *background, const uint8_t *sprites,
+                                uint8_t zero_color);
+
+/* The pixel processing functions, implemented for one instruction set. */
+typedef struct pixel_kernels {
+  const char *name;
+  decode_tile_t decode_tile;
+  map_palette_t map_palette;
+  combine_lines_t combine_lines;
+} pixel_kernels_t;
+
+extern const pixel_kernels_t scalar_pixel_kernels;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_PIXEL_KERNELS
+extern const pixel_kernels_t sse2_pixel_kernels;
+extern const pixel_kernels_t avx2_pixel_kernels;
+#endif
+
+/* Returns the fastest kernels the cpu we are running on supports. */
+const pixel_kernels_t *pixel_kernels_select(void);
@@ -4,9 +4,13 @@
 #include <memory/memory_handler.h>
 #include <memory/mmu.h>
 #include <cpu/interrupts.h>
+#include <cpu/scheduler.h>
+#include <save_state.h>
 #include "ppu.h"
 #include "video.h"
 #include "iterator.h"
+#include "tile_cache.h"
+#include "pixel_kernels.h"
 #include "display.h"
 
 #define REG_BASE 0xFF40
@@ -34,6 +38,7 @@ typedef struct ppu_memory_handler {
 typedef struct vram_handler {
   mem_handler_t base;
   uint8_t *video_ram;
+  ppu_t *ppu;
 } vram_handler_t;
 
 typedef struct pixel_processing_unit {
@@ -49,12 +54,33 @@ typedef struct pixel_processing_unit {
   int num_visible_sprites;
 
   camera_iterator_t beam_position;
-  uint16_t scan_line_counter;
+  const pixel_kernels_t *kernels;
+  tile_cache_t tile_cache;
+  scheduler_t *scheduler;
+  bool frame_ready;
+
+  /* draw every nth frame, 0 means never */
+  uint32_t render_interval;
+  uint32_t frame_count;
+  bool render_frame;
+  bool lines_drawn;
+  bool frame_drawn;
+
+  /* the lines are drawn here and handed to the display as a whole */
+  uint8_t framebuffer[FRAMEBUFFER_HEIGHT][FRAMEBUFFER_WIDTH];
+  uint64_t frame_number;
 
   ppu_mem_handler_t handler;
   vram_handler_t vram_handler;
 } ppu_t;
 
+/* the ppu is held in v-blank while the lcd is off */
+static void lcd_disable(ppu_t *ppu) {
+  ppu->lines_drawn = false;
+  ppu->registers->lcdc_y = 0x99;
+  set_mode(ppu->interrupt_line, ppu->registers, 1);
+}
+
 DEF_MEM_READ(ppu_read) {
   ppu_mem_handler_t *handler = (ppu_mem_handler_t *) this;
   ppu_regs_t *registers = handler->ppu->registers;
@@ -96,6 +122,20 @@ DEF_MEM_WRITE(ppu_write) {
   uint8_t current_value = start[address - REG_BASE];
 
   switch (address) {
+    case 0xFF40:
+      if ((value ^ current_value) & 0x80) {
+        ppu_t *ppu = handler->ppu;
+        if (value & 0x80) {
+          /* the first line starts after the v-blank the ppu was held in */
+          ppu->registers->lcdc_y = 0x99;
+          scheduler_schedule(ppu->scheduler, EVENT_PPU, ppu->scheduler->now);
+        } else {
+          scheduler_cancel(ppu->scheduler, EVENT_PPU);
+          lcd_disable(ppu);
+        }
+      }
+      break;
+
     case 0xFF41:
       /* the last three bits are read only */
       value = (value & ~7) | (current_value & 7);
@@ -121,7 +161,11 @@ DEF_MEM_WRITE(ppu_write) {
 
 static DEF_MEM_WRITE(vram_write) {
   vram_handler_t *handler = (vram_handler_t *) this;
-  handler->video_ram[address & ~(0xE000)] = value;
+  uint16_t offset = address & ~(0xE000);
+  handler->video_ram[offset] = value;
+
+  tile_cache_invalidate(&handler->ppu->tile_cache, offset);
+  mmu_report_write(handler->ppu->mmu, address);
 }
 
 static DEF_MEM_READ(vram_read) {
@@ -158,15 +202,23 @@ ppu_t *ppu_new(mmu_t *mmu, cpu_t *interrupt_line, uint8_t *vram,
   mmu_register_mem_handler(mmu, (mem_handler_t *) &ppu->handler, tuple.handle);
 
   ppu->vram_handler.video_ram = vram;
+  ppu->vram_handler.ppu = ppu;
   ppu->vram_handler.base.write = vram_write;
   ppu->vram_handler.base.read = vram_read;
   ppu->vram_handler.base.destroy = mem_handler_stack_destroy;
 
   mmu_assign_vram_handler(mmu, (mem_handler_t *)&ppu->vram_handler);
+  /* writes to the tile data go through the handler to update the cache */
+  mmu_map_direct_memory(mmu, 0x8000, 0x97FF, vram, MMU_DIRECT_READ);
+  mmu_map_direct_memory(mmu, 0x9800, 0x9FFF, vram + 0x1800,
+                        MMU_DIRECT_READ | MMU_DIRECT_WRITE);
 
   ppu->vram = vram;
+  ppu->kernels = pixel_kernels_select();
+  tile_cache_init(&ppu->tile_cache, vram, ppu->kernels);
   ppu->display = display;
-  ppu->scan_line_counter = 456;
+  ppu->render_interval = 1;
+  ppu->render_frame = true;
   reset_beam(ppu);
 
   return ppu;
@@ -226,9 +278,8 @@ static void render_background_line(ppu_t *ppu, uint8_t *buffer) {
   uint8_t palette[4];
   decode_palette(regs->bg_palette, palette);
 
-  /* compute start and end of the line and then draw it */
-  for (int i = 0; i < 160; ++i)
-    buffer[i] = next_pixel(it, find_tile, palette);
+  next_line(it, &ppu->tile_cache, find_tile, buffer);
+  ppu->kernels->map_palette(buffer, palette);
 }
 
 static void render_sprite_line(ppu_t *ppu, uint8_t *buffer) {
@@ -258,15 +309,17 @@ static void render_sprite_line(ppu_t *ppu, uint8_t *buffer) {
       sprite_line = h - sprite_line - 1;
     }
 
-    uint16_t line = decode_tile_line(tile, sprite_line);
-    if (x_flip) { line = flip_line(line); }
+    /* 8x16 sprites continue in the next tile */
+    const uint8_t *line = tile_cache_row(&ppu->tile_cache,
+                                         tile + (sprite_line >> 3),
+                                         sprite_line & 7);
 
     for (int j = 0; j < 8; ++j) {
       int idx = sprite->pos_x - 8 + j;
       if (idx < 0 | idx >= 160)
         continue;
 
-      uint8_t color = get_pixel(line, j);
+      uint8_t color = line[x_flip ? 7 - j : j];
       if (!color)
         continue;
 
@@ -276,35 +329,34 @@ static void render_sprite_line(ppu_t *ppu, uint8_t *buffer) {
   }
 }
 
-static void
-combine_lines(uint8_t *background, uint8_t *sprites, uint8_t zero_color) {
-  for (int i = 0; i < 160; ++i) {
-    uint8_t sprite = sprites[i] & 3;
-    uint8_t visible = (sprites[i] >> 2) & 3;
-    bool priority = (sprites[i] & 0x80) != 0;
-
-    if (!visible)
-      continue;
-
-    if (priority && (background[i] != zero_color))
-      continue;
-
-    background[i] = sprite;
-  }
-}
-
 static void render_line(ppu_t *ppu) {
-  uint8_t background[160];
+  /* nothing to draw on, e.g. when running headless, or a skipped frame */
+  if (!ppu->display || !ppu->render_frame) return;
+
+  uint8_t *background = ppu->framebuffer[ppu->registers->lcdc_y];
   uint8_t sprites[160] = {0};
+  ppu->lines_drawn = true;
 
   render_background_line(ppu, background);
 
   if (obj_enabled(ppu->registers)) {
     render_sprite_line(ppu, sprites);
-    combine_lines(background, sprites, ppu->registers->bg_palette & 3);
+    ppu->kernels->combine_lines(background, sprites,
+                                ppu->registers->bg_palette & 3);
   }
+}
+
+/* hands the completed frame to the display */
+static void present_frame(ppu_t *ppu) {
+  display_t *display = ppu->display;
 
-  ppu->display->draw_line(ppu->display, background);
+  if (display->draw_frame) {
+    display->draw_frame(display, &ppu->framebuffer[0][0], ppu->frame_number);
+    return;
+  }
+
+  for (int y = 0; y < FRAMEBUFFER_HEIGHT; ++y)
+    display->draw_line(display, ppu->framebuffer[y]);
 }
 
 static void lcd_new_line(ppu_t *ppu) {
@@ -313,95 +365,177 @@ static void lcd_new_line(ppu_t *ppu) {
   set_mode(ppu->interrupt_line, ppu->registers, 2);
 }
 
-int mode_0_h_blank(ppu_t *ppu) {
+static void mode_0_h_blank(ppu_t *ppu) {
   ppu_regs_t *regs = ppu->registers;
 
-  if (ppu->scan_line_counter >= 204) {
-    ppu->scan_line_counter -= 204;
-
-    lcd_new_line(ppu);
-    render_line(ppu);
+  lcd_new_line(ppu);
+  render_line(ppu);
 
-    if (++regs->lcdc_y == 144) {
-      regs->lcd_status += 1;
+  if (++regs->lcdc_y == 144) {
+    regs->lcd_status += 1;
 
-      raise_interrupt(ppu->interrupt_line, INT_VBLANK);
-      set_mode(ppu->interrupt_line, regs, 1);
-    }
+    raise_interrupt(ppu->interrupt_line, INT_VBLANK);
+    set_mode(ppu->interrupt_line, regs, 1);
   }
-
-  return 0;
 }
 
-int mode_1_v_blank(ppu_t *ppu) {
+static void mode_1_v_blank(ppu_t *ppu) {
   ppu_regs_t *regs = ppu->registers;
 
-  if (ppu->scan_line_counter >= 456) {
-    ppu->scan_line_counter -= 456;
-
-    if (++regs->lcdc_y == 154) {
-      lcd_new_line(ppu);
-      reset_beam(ppu);
-      regs->lcdc_y = 0;
-      return 1;
-    }
+  if (++regs->lcdc_y == 154) {
+    lcd_new_line(ppu);
+    reset_beam(ppu);
+    regs->lcdc_y = 0;
+    ppu->frame_ready = true;
+
+    /* nothing was drawn if the lcd was just switched on */
+    ppu->frame_drawn = ppu->lines_drawn;
+    ppu->lines_drawn = false;
+    if (ppu->frame_drawn)
+      present_frame(ppu);
+    ++ppu->frame_number;
+
+    ppu->render_frame = ppu->render_interval &&
+                        ppu->frame_count % ppu->render_interval == 0;
+    ++ppu->frame_count;
   }
+}
 
-  return 0;
+static void mode_2_search_oam(ppu_t *ppu) {
+  set_mode(ppu->interrupt_line, ppu->registers, 3);
 }
 
-int mode_2_search_oam(ppu_t *ppu) {
+static void mode_3_transfer_data(ppu_t *ppu) {
   ppu_regs_t *regs = ppu->registers;
 
-  if (ppu->scan_line_counter >= 80) {
-    ppu->scan_line_counter -= 80;
-    set_mode(ppu->interrupt_line, regs, 3);
+  if (check_coincidence(regs)) {
+    raise_interrupt(ppu->interrupt_line, INT_LCD_STAT);
   }
 
-  return 0;
+  set_mode(ppu->interrupt_line, regs, 0);
 }
 
-int mode_3_transfer_data(ppu_t *ppu) {
-  ppu_regs_t *regs = ppu->registers;
+/* ends the current mode and switches to the next one */
+static void (*const run_mode[])(ppu_t *ppu) = {
+    mode_0_h_blank, mode_1_v_blank, mode_2_search_oam, mode_3_transfer_data
+};
 
-  if (ppu->scan_line_counter >= 172) {
-    ppu->scan_line_counter -= 172;
+/* how many cycles the ppu stays in each mode */
+static const uint16_t mode_duration[] = {
+    204, 456, 80, 172
+};
 
-    if (check_coincidence(regs)) {
-      raise_interrupt(ppu->interrupt_line, INT_LCD_STAT);
-    }
+static void ppu_mode_event(void *context, uint64_t time) {
+  ppu_t *ppu = (ppu_t *) context;
+  ppu_regs_t *regs = ppu->registers;
 
-    set_mode(ppu->interrupt_line, regs, 0);
+  if (!lcd_enabled(regs)) {
+    /* nothing happens until the lcd is switched on again */
+    lcd_disable(ppu);
+    return;
   }
 
-  return 0;
+  run_mode[get_mode(regs)](ppu);
+
+  scheduler_schedule(ppu->scheduler, EVENT_PPU,
+                     time + mode_duration[get_mode(regs)]);
 }
 
-int (*const run_mode[])(ppu_t *ppu) = {
-    mode_0_h_blank, mode_1_v_blank, mode_2_search_oam, mode_3_transfer_data
-};
+/*
+ * Lets the ppu schedule its mode changes, starting right away.
+ * .scheduler   Runs the events, its clock is the time of the cpu.
+ */
+void ppu_start(ppu_t *ppu, scheduler_t *scheduler) {
+  ppu->scheduler = scheduler;
+  scheduler_register(scheduler, EVENT_PPU, ppu_mode_event, ppu);
+  scheduler_schedule(scheduler, EVENT_PPU, scheduler->now);
+}
 
-typedef struct cpu cpu_t;
 /*
- * Updates the LCD inner state. Returns true if the screen should be updated.
- * .cycles      The amount of cpu cycles passed since the last update.
+ * Returns true once after a frame is completed and the screen should be
+ * updated.
  */
-bool ppu_update(ppu_t *ppu, uint8_t cycles) {
-  ppu_regs_t *regs = ppu->registers;
-  bool update_screen = false;
+bool ppu_frame_ready(ppu_t *ppu) {
+  bool ready = ppu->frame_ready;
+  ppu->frame_ready = false;
+  return ready;
+}
 
-  if (!lcd_enabled(regs)) {
-    ppu->scan_line_counter = 456;
-    regs->lcdc_y = 0x99;
+/*
+ * Returns true if the last completed frame was drawn to the display, false
+ * if it was skipped.
+ */
+bool ppu_frame_drawn(ppu_t *ppu) {
+  return ppu->frame_drawn;
+}
 
-    set_mode(ppu->interrupt_line, regs, 1);
-    return false;
-  }
+/*
+ * Only draws every nth frame, starting with the next one. Timing,
+ * interrupts and the oam search are the same for skipped frames.
+ * .interval    Draw every 'interval' frames, 0 draws no frame at all.
+ */
+void ppu_set_render_interval(ppu_t *ppu, uint32_t interval) {
+  ppu->render_interval = interval;
+  ppu->frame_count = 0;
+}
 
-  ppu->scan_line_counter += cycles;
-  if (run_mode[get_mode(regs)](ppu)) {
-    update_screen = true;
-  }
+/* pointers into video ram are saved as offsets, -1 stands for NULL */
+static int32_t vram_offset(ppu_t *ppu, void *pointer) {
+  return pointer ? (int32_t) ((uint8_t *) pointer - ppu->vram) : -1;
+}
+
+static void *vram_pointer(ppu_t *ppu, int32_t offset) {
+  return offset < 0 ? 0 : ppu->vram + offset;
+}
+
+/*
+ * Writes the inner state of the ppu. The registers, the oam and the video
+ * ram are saved with the memory, the time of the next mode change with the
+ * scheduler.
+ */
+void ppu_save_state(ppu_t *ppu, state_buffer_t *state) {
+  camera_iterator_t *it = &ppu->beam_position;
+  int32_t beam[] = {
+      it->screen_pixel_x, it->screen_pixel_y, it->scroll_x, it->scroll_y,
+      it->window_x, it->window_y, vram_offset(ppu, it->tiles),
+      vram_offset(ppu, it->display), vram_offset(ppu, it->window)
+  };
+  state_write_value(state, beam);
+
+  uint8_t sprites[10] = {0};
+  for (int i = 0; i < ppu->num_visible_sprites; ++i)
+    sprites[i] = (uint8_t) (ppu->visible_sprites[i] - ppu->oam);
+
+  uint8_t num_sprites = (uint8_t) ppu->num_visible_sprites;
+  state_write_value(state, num_sprites);
+  state_write_value(state, sprites);
+  state_write_value(state, ppu->frame_ready);
+}
 
-  return update_screen;
+void ppu_load_state(ppu_t *ppu, state_buffer_t *state) {
+  int32_t beam[9];
+  state_read_value(state, beam);
+
+  camera_iterator_t *it = &ppu->beam_position;
+  it->screen_pixel_x = beam[0];
+  it->screen_pixel_y = beam[1];
+  it->scroll_x = beam[2];
+  it->scroll_y = beam[3];
+  it->window_x = beam[4];
+  it->window_y = beam[5];
+  it->tiles = vram_pointer(ppu, beam[6]);
+  it->display = vram_pointer(ppu, beam[7]);
+  it->window = vram_pointer(ppu, beam[8]);
+
+  uint8_t num_sprites;
+  uint8_t sprites[10];
+  state_read_value(state, num_sprites);
+  state_read_value(state, sprites);
+
+  ppu->num_visible_sprites = num_sprites > 10 ? 10 : num_sprites;
+  for (int i = 0; i < ppu->num_visible_sprites; ++i)
+    ppu->visible_sprites[i] = &ppu->oam[sprites[i] % 40];
+
+  state_read_value(state, ppu->frame_ready);
+  tile_cache_invalidate_all(&ppu->tile_cache);
 }
@@ -6,11 +6,23 @@
 typedef struct pixel_processing_unit ppu_t;
 typedef struct cpu cpu_t;
 typedef struct display display_t;
+typedef struct scheduler scheduler_t;
+typedef struct state_buffer state_buffer_t;
 
 ppu_t *ppu_new(mmu_t *mmu, cpu_t *interrupt_line, uint8_t *vram,
                display_t *display);
 
 void ppu_delete(ppu_t *ppu);
 
-bool ppu_update(ppu_t *ppu, uint8_t cycles);
+void ppu_start(ppu_t *ppu, scheduler_t *scheduler);
+
+bool ppu_frame_ready(ppu_t *ppu);
+
+bool ppu_frame_drawn(ppu_t *ppu);
+
+void ppu_set_render_interval(ppu_t *ppu, uint32_t interval);
+
+void ppu_save_state(ppu_t *ppu, state_buffer_t *state);
+
+void ppu_load_state(ppu_t *ppu, state_buffer_t *state);
 
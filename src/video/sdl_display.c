@@ -6,85 +6,128 @@
 
 typedef struct sdl_display {
   display_t base;
-  int line_counter;
   SDL_Window *window;
-  SDL_Surface *surface;
+  SDL_Renderer *renderer;
+  SDL_Texture *texture;
+  bool vsync;
+  uint32_t pixels[FRAMEBUFFER_SIZE];
 } sdl_display_t;
 
-void sdl_display_draw_line(display_t *this, uint8_t *line) {
+static void sdl_display_draw_frame(display_t *this, const uint8_t *pixels,
+                                   uint64_t frame_number) {
   sdl_display_t *display = (sdl_display_t *) this;
 
   static const uint32_t to_sdl_color[] = {
-      0x00FFFFFF, 0x00AAAAAA, 0x00555555, 0x00000000
+      0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000
   };
-  uint32_t *pixel_buffer = (uint32_t *) display->surface->pixels;
-  pixel_buffer += display->line_counter++ * 160;
 
-  if (display->line_counter == 144)
-    display->line_counter = 0;
+  for (int i = 0; i < FRAMEBUFFER_SIZE; ++i)
+    display->pixels[i] = to_sdl_color[pixels[i]];
 
-  for (int i = 0; i < 160; ++i)
-    pixel_buffer[i] = to_sdl_color[line[i]];
+  if (SDL_UpdateTexture(display->texture, NULL, display->pixels,
+                        FRAMEBUFFER_WIDTH * sizeof(uint32_t))) {
+    logging_error(SDL_GetError());
+    abort();
+  }
 }
 
+/* scaling is done by the renderer, on the gpu if there is one */
 void sdl_display_show(display_t *this) {
   sdl_display_t *display = (sdl_display_t *) this;
-  if (SDL_BlitScaled(display->surface, NULL,
-                     SDL_GetWindowSurface(display->window), NULL)) {
-    logging_error(SDL_GetError());
-    abort();
-  }
-  SDL_UpdateWindowSurface(display->window);
+  SDL_RenderClear(display->renderer);
+  SDL_RenderCopy(display->renderer, display->texture, NULL, NULL);
+  SDL_RenderPresent(display->renderer);
 }
 
 void sdl_display_delete(display_t *this) {
   sdl_display_t *display = (sdl_display_t *) this;
-  SDL_FreeSurface(display->surface);
+  SDL_DestroyTexture(display->texture);
+  SDL_DestroyRenderer(display->renderer);
   SDL_DestroyWindow(display->window);
   free(this);
 }
 
-display_t *sdl_display_new(void) {
+/*
+ * Uses an accelerated renderer if possible, else the software renderer,
+ * e.g. for the dummy video driver.
+ */
+static SDL_Renderer *create_renderer(SDL_Window *window, bool vsync) {
+  uint32_t flags = vsync ? SDL_RENDERER_PRESENTVSYNC : 0;
+
+  SDL_Renderer *renderer =
+      SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | flags);
+  if (renderer) return renderer;
+
+  logging_warning("No accelerated renderer, using the software renderer.");
+  return SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE | flags);
+}
+
+/*
+ * Creates a window showing the frames, scaled by the renderer.
+ * .scale       The initial size of the window, in multiples of the screen.
+ *              The frame is always scaled by whole numbers.
+ * .vsync       Wait for the vertical sync of the monitor when showing a
+ *              frame, if the renderer supports it.
+ */
+display_t *sdl_display_new(int scale, bool vsync) {
   sdl_display_t *display = calloc(1, sizeof(sdl_display_t));
   if (!display) {
     logging_std_error();
     return 0;
   }
 
+  if (scale < 1) scale = 1;
+
   SDL_Window *window = SDL_CreateWindow("GameBoy",
                                         SDL_WINDOWPOS_CENTERED,
-                                        SDL_WINDOWPOS_CENTERED, 640, 576, 0);
+                                        SDL_WINDOWPOS_CENTERED,
+                                        FRAMEBUFFER_WIDTH * scale,
+                                        FRAMEBUFFER_HEIGHT * scale,
+                                        SDL_WINDOW_RESIZABLE);
   atexit(SDL_Quit);
 
   if (!window) goto sdl_fail;
+  display->window = window;
+  SDL_SetWindowMinimumSize(window, FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT);
 
-  SDL_Surface *window_surface = SDL_GetWindowSurface(window);
-  if (!window_surface) goto sdl_fail;
+  /* sharp pixels */
+  SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
 
-  SDL_Surface *surface = SDL_CreateRGBSurface(
-      0, 160, 144,
-      window_surface->format->BitsPerPixel,
-      window_surface->format->Rmask,
-      window_surface->format->Gmask,
-      window_surface->format->Bmask,
-      window_surface->format->Amask);
+  SDL_Renderer *renderer = create_renderer(window, vsync);
+  if (!renderer) goto sdl_fail;
+  display->renderer = renderer;
 
-  if (!surface) goto sdl_fail;
+  SDL_RenderSetLogicalSize(renderer, FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT);
+  SDL_RenderSetIntegerScale(renderer, SDL_TRUE);
 
-  display->base.draw_line = sdl_display_draw_line;
-  display->base.show = sdl_display_show;
-  display->base.delete = sdl_display_delete;
+  SDL_RendererInfo info;
+  if (SDL_GetRendererInfo(renderer, &info)) goto sdl_fail;
+  display->vsync = (info.flags & SDL_RENDERER_PRESENTVSYNC) != 0;
 
-  display->window = window;
-  display->surface = surface;
+  SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                           SDL_TEXTUREACCESS_STREAMING,
+                                           FRAMEBUFFER_WIDTH,
+                                           FRAMEBUFFER_HEIGHT);
+  if (!texture) goto sdl_fail;
+  display->texture = texture;
 
-  display->line_counter = 0;
+  display->base.draw_frame = sdl_display_draw_frame;
+  display->base.show = sdl_display_show;
+  display->base.delete = sdl_display_delete;
 
   return (display_t *) display;
 
   sdl_fail:
-  free(display);
   logging_error(SDL_GetError());
+  if (display->renderer)
+    SDL_DestroyRenderer(display->renderer);
+  if (display->window)
+    SDL_DestroyWindow(display->window);
+  free(display);
   return 0;
 }
 
+/* Returns true if showing a frame waits for the vertical sync. */
+bool sdl_display_has_vsync(display_t *this) {
+  return ((sdl_display_t *) this)->vsync;
+}
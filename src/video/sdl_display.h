@@ -1,4 +1,7 @@
+#include <stdbool.h>
+
 #include "display.h"
 
-display_t *sdl_display_new(void);
+display_t *sdl_display_new(int scale, bool vsync);
 void sdl_display_delete(display_t *display);
+bool sdl_display_has_vsync(display_t *display);
@@ -0,0 +1,95 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "shm_display.h"
+
+#include <logging.h>
+
+typedef struct shm_display {
+  display_t base;
+  /* our copy of the sequence, only we write it */
+  uint64_t sequence;
+  int back;
+  shm_frames_t *shared;
+  char *name;
+} shm_display_t;
+
+static void shm_display_show(display_t *this) {
+  shm_display_t *display = (shm_display_t *) this;
+
+  /* publish the finished frame and draw the next one into the other */
+  ++display->sequence;
+  atomic_store_explicit(&display->shared->sequence, display->sequence,
+                        memory_order_release);
+
+  display->back = (display->sequence + 1) & 1;
+}
+
+static void shm_display_draw_frame(display_t *this, const uint8_t *pixels,
+                                   uint64_t frame_number) {
+  shm_display_t *display = (shm_display_t *) this;
+  memcpy(display->shared->frames[display->back], pixels, FRAMEBUFFER_SIZE);
+  display->shared->frame_numbers[display->back] = frame_number;
+}
+
+static void shm_display_delete(display_t *this) {
+  shm_display_t *display = (shm_display_t *) this;
+
+  munmap(display->shared, sizeof(shm_frames_t));
+  shm_unlink(display->name);
+  free(display->name);
+  free(display);
+}
+
+/*
+ * Creates a display that draws into POSIX shared memory, so other
+ * processes can read the frames without copying them, see shm_frames_t.
+ * The shared memory is removed when the display is deleted.
+ * .name        The name of the shared memory, e.g. "/mage".
+ */
+display_t *shm_display_new(const char *name) {
+  shm_display_t *display = 0;
+  int fd = -1;
+
+  display = calloc(1, sizeof(shm_display_t));
+  if (!display) goto fail;
+
+  display->name = strdup(name);
+  if (!display->name) goto fail;
+
+  fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) goto fail;
+
+  if (ftruncate(fd, sizeof(shm_frames_t)) < 0) goto fail;
+
+  void *memory = mmap(0, sizeof(shm_frames_t), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  if (memory == MAP_FAILED) goto fail;
+  close(fd);
+
+  display->shared = (shm_frames_t *) memory;
+  display->shared->magic = SHM_DISPLAY_MAGIC;
+  display->shared->width = FRAMEBUFFER_WIDTH;
+  display->shared->height = FRAMEBUFFER_HEIGHT;
+  atomic_store(&display->shared->sequence, 0);
+  display->back = 1;
+
+  display->base.show = shm_display_show;
+  display->base.draw_frame = shm_display_draw_frame;
+  display->base.delete = shm_display_delete;
+
+  return (display_t *) display;
+
+fail:
+  logging_std_error();
+  if (fd >= 0) {
+    close(fd);
+    shm_unlink(name);
+  }
+  if (display)
+    free(display->name);
+  free(display);
+  return 0;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "display.h"
+#include "framebuffer_display.h"
+
+#define SHM_DISPLAY_MAGIC 0x4D48534D
+
+/*
+ * The layout of the shared memory, for the programs reading the frames.
+ * Every pixel is one byte holding the shade (0-3), the lines are stored
+ * top to bottom. While frames[sequence & 1] is read, the next frame is
+ * drawn into the other one. A reader has to check that 'sequence' did not
+ * change after reading a frame, otherwise the frame may be torn.
+ */
+typedef struct shm_frames {
+  uint32_t magic;
+  uint16_t width;
+  uint16_t height;
+  /* the number of completed frames */
+  _Atomic uint64_t sequence;
+  /* counts skipped frames as well, gaps show dropped frames */
+  uint64_t frame_numbers[2];
+  uint8_t frames[2][FRAMEBUFFER_SIZE];
+} shm_frames_t;
+
+display_t *shm_display_new(const char *name);
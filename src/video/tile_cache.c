@@ -0,0 +1,18 @@
+#include <string.h>
+#include "tile_cache.h"
+
+void tile_cache_init(tile_cache_t *cache, uint8_t *vram,
+                     const pixel_kernels_t *kernels) {
+  cache->tiles = (px_data_t *) vram;
+  cache->decode = kernels->decode_tile;
+  tile_cache_invalidate_all(cache);
+}
+
+void tile_cache_invalidate_all(tile_cache_t *cache) {
+  memset(cache->dirty, true, sizeof(cache->dirty));
+}
+
+void tile_cache_decode(tile_cache_t *cache, int index) {
+  cache->decode(cache->tiles + index, &cache->pixels[index][0][0]);
+  cache->dirty[index] = false;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "video.h"
+#include "iterator.h"
+#include "pixel_kernels.h"
+
+#define NUM_TILES 384
+
+/*
+ * Keeps the tiles of the video ram decoded to one color index per pixel.
+ * Writes to the tile data mark tiles dirty, they are decoded again when
+ * they are used the next time.
+ */
+typedef struct tile_cache {
+  px_data_t *tiles;
+  decode_tile_t decode;
+  uint8_t pixels[NUM_TILES][8][8];
+  bool dirty[NUM_TILES];
+} tile_cache_t;
+
+void tile_cache_init(tile_cache_t *cache, uint8_t *vram,
+                     const pixel_kernels_t *kernels);
+
+void tile_cache_invalidate_all(tile_cache_t *cache);
+
+void tile_cache_decode(tile_cache_t *cache, int index);
+
+/* .offset   The offset of the written byte in the video ram */
+static inline void tile_cache_invalidate(tile_cache_t *cache,
+                                         uint16_t offset) {
+  if (offset < NUM_TILES * sizeof(px_data_t))
+    cache->dirty[offset / sizeof(px_data_t)] = true;
+}
+
+/* Returns the 8 color indices of one row of the tile. */
+static inline const uint8_t *
+tile_cache_row(tile_cache_t *cache, px_data_t *tile, int row) {
+  int index = (int) (tile - cache->tiles);
+  if (cache->dirty[index])
+    tile_cache_decode(cache, index);
+  return cache->pixels[index][row];
+}
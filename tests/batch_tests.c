@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "driver/testing.h"
+#include "src/gameboy_batch.h"
+#include "src/video/framebuffer_display.h"
+
+/* A rom that fills the whole background with tile 0, all of it 'shade'. */
+static char *write_tile_rom(uint8_t shade) {
+  const uint8_t program[] = {
+      0xF3,               /* 0150  DI */
+      0xAF,               /* 0151  XOR A */
+      0xE0, 0x40,         /* 0152  LDH (0x40), A   ; lcd off */
+      0x21, 0x00, 0x80,   /* 0154  LD HL, 0x8000 */
+      0x3E, shade,        /* 0157  LD A, shade */
+      0x06, 0x10,         /* 0159  LD B, 16 */
+      0x22,               /* 015B  LD (HL+), A     ; tile 0 */
+      0x05,               /* 015C  DEC B */
+      0x20, 0xFC,         /* 015D  JR NZ, 0x015B */
+      0x3E, 0x91,         /* 015F  LD A, 0x91 */
+      0xE0, 0x40,         /* 0161  LDH (0x40), A   ; lcd on */
+      0x18, 0xFE,         /* 0163  JR 0x0163 */
+  };
+
+  uint8_t *rom = calloc(1, 0x8000);
+  static const uint8_t entry[] = {0x00, 0xC3, 0x50, 0x01};
+  memcpy(rom + 0x100, entry, sizeof(entry));
+  memcpy(rom + 0x150, program, sizeof(program));
+
+  char *path = write_test_rom(rom, 0x8000);
+  free(rom);
+  return path;
+}
+
+static const uint8_t *framebuffer(gb_batch_t batch, size_t index) {
+  return game_boy_batch_framebuffers(batch) + index * FRAMEBUFFER_SIZE;
+}
+
+/* the same game draws the same frames in every instance */
+TEST(test_batch_same_game,
+  char *path = write_tile_rom(0xFF);
+  gb_batch_t batch = game_boy_batch_new(4, 2);
+  assert(batch && game_boy_batch_size(batch) == 4);
+  for (size_t i = 0; i < 4; ++i)
+    game_boy_insert_game(game_boy_batch_get(batch, i), path, 0);
+
+  game_boy_batch_run(batch, 10);
+
+  const uint8_t *first = framebuffer(batch, 0);
+  assert(first[0] != 0 && first[FRAMEBUFFER_SIZE - 1] == first[0]);
+  for (size_t i = 1; i < 4; ++i)
+    assert(memcmp(first, framebuffer(batch, i), FRAMEBUFFER_SIZE) == 0);
+
+  game_boy_batch_delete(batch);
+  unlink(path);
+  free(path);
+)
+
+/* another game in one instance changes none of the others */
+TEST(test_batch_independent_instances,
+  char *path = write_tile_rom(0xFF);
+  char *other_path = write_tile_rom(0x00);
+  gb_batch_t batch = game_boy_batch_new(4, 2);
+  for (size_t i = 0; i < 4; ++i)
+    game_boy_insert_game(game_boy_batch_get(batch, i),
+                         i == 2 ? other_path : path, 0);
+
+  game_boy_batch_run(batch, 10);
+
+  const uint8_t *first = framebuffer(batch, 0);
+  assert(memcmp(first, framebuffer(batch, 1), FRAMEBUFFER_SIZE) == 0);
+  assert(memcmp(first, framebuffer(batch, 3), FRAMEBUFFER_SIZE) == 0);
+  assert(first[0] != framebuffer(batch, 2)[0]);
+
+  game_boy_batch_delete(batch);
+  unlink(path);
+  unlink(other_path);
+  free(path);
+  free(other_path);
+)
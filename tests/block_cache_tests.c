@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "driver/testing.h"
+#include "src/memory/mmu.h"
+
+/* a fixed rom bank and two switchable ones, mapped directly like a cartridge */
+static uint8_t fixed_bank[0x4000];
+static uint8_t banks[2][0x4000];
+
+static void map_rom(cpu_t *cpu, int bank) {
+  mmu_map_direct_memory(cpu->mmu, 0x0000, 0x3FFF, fixed_bank,
+                        MMU_DIRECT_READ);
+  mmu_map_direct_memory(cpu->mmu, 0x4000, 0x7FFF, banks[bank],
+                        MMU_DIRECT_READ);
+}
+
+static void unmap_rom(cpu_t *cpu) {
+  mmu_unmap_direct_memory(cpu->mmu, 0x0000, 0x7FFF);
+}
+
+/* LD A, value; RET at the start of the bank */
+static void write_bank_routine(int bank, uint8_t value) {
+  banks[bank][0] = 0x3E;
+  banks[bank][1] = value;
+  banks[bank][2] = 0xC9;
+}
+
+static void write_call(uint8_t *code, gb_address_t address) {
+  code[0] = 0x31; /* LD SP, 0xFFF0 */
+  code[1] = 0xF0;
+  code[2] = 0xFF;
+  code[3] = 0xCD; /* CALL address */
+  code[4] = (uint8_t) address;
+  code[5] = (uint8_t) (address >> 8);
+  code[6] = 0x00;
+}
+
+/* a block running from the fixed bank into the switchable one must not
+ * survive a bank switch */
+TEST(test_block_cache_block_into_switched_bank,
+  memset(fixed_bank, 0, sizeof(fixed_bank));
+  write_call(fixed_bank, 0x3FF0);
+  /* LD B, B up to the end of the fixed bank, NOP would stop the test */
+  memset(fixed_bank + 0x3FF0, 0x40, 0x10);
+  write_bank_routine(0, 0x11);
+  write_bank_routine(1, 0x22);
+
+  map_rom(cpu, 0);
+  run(cpu);
+  assert(cpu->A == 0x11);
+
+  map_rom(cpu, 1);
+  cpu->pc = 0;
+  run(cpu);
+  assert(cpu->A == 0x22);
+
+  unmap_rom(cpu);
+)
+
+/* code in work ram is cached, overwriting it has to drop the block */
+TEST(test_block_cache_self_modifying_code,
+  static const uint8_t program[] = {
+      0x31, 0xF0, 0xFF, /* LD SP, 0xFFF0 */
+      0xCD, 0x00, 0xC0, /* CALL 0xC000 */
+      0x47,             /* LD B, A */
+      0x3E, 0x33,       /* LD A, 0x33 */
+      0xEA, 0x01, 0xC0, /* LD (0xC001), A */
+      0xCD, 0x00, 0xC0, /* CALL 0xC000 */
+      0x4F,             /* LD C, A */
+      0x3E, 0x44,       /* LD A, 0x44 */
+      0xEA, 0x01, 0xE0, /* LD (0xE001), A  ; through the echo ram */
+      0xCD, 0x00, 0xC0, /* CALL 0xC000 */
+      0x00,
+  };
+  for (gb_address_t i = 0; i < sizeof(program); ++i)
+    __test_write(cpu, i, program[i]);
+
+  __test_write(cpu, 0xC000, 0x3E); /* LD A, 0x11 */
+  __test_write(cpu, 0xC001, 0x11);
+  __test_write(cpu, 0xC002, 0xC9); /* RET */
+
+  run(cpu);
+
+  assert(cpu->B == 0x11);
+  assert(cpu->C == 0x33);
+  assert(cpu->A == 0x44);
+)
+
+/* the same pc in another bank is other code */
+TEST(test_block_cache_bank_switch,
+  memset(fixed_bank, 0, sizeof(fixed_bank));
+  write_call(fixed_bank, 0x4000);
+  write_bank_routine(0, 0x11);
+  write_bank_routine(1, 0x22);
+
+  uint8_t expected[] = {0x11, 0x22, 0x11};
+  for (int i = 0; i < 3; ++i) {
+    map_rom(cpu, i & 1);
+    cpu->pc = 0;
+    run(cpu);
+    assert(cpu->A == expected[i]);
+  }
+
+  unmap_rom(cpu);
+)
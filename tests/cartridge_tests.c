@@ -0,0 +1,500 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "driver/testing.h"
+#include "src/cartridge.h"
+#include "src/frame_pacer.h"
+
+/*
+ * Writes a rom whose banks start with their number and inserts it.
+ * .rom_size    The rom size byte of the header, there are 2 << rom_size
+ *              banks.
+ * .save_file   May be NULL, see cartridge_new().
+ * .policy      May be NULL as well.
+ */
+static cartridge_t *insert_game(uint8_t type, uint8_t rom_size,
+                                uint8_t ram_size, const char *save_file,
+                                const save_policy_t *policy) {
+  size_t size = (size_t) 0x8000 << rom_size;
+  uint8_t *rom = calloc(1, size);
+  for (size_t bank = 0; bank < size / 0x4000; ++bank) {
+    rom[bank * 0x4000] = (uint8_t) bank;
+    rom[bank * 0x4000 + 1] = (uint8_t) (bank >> 8);
+  }
+  rom[0x147] = type;
+  rom[0x148] = rom_size;
+  rom[0x149] = ram_size;
+
+  char *path = write_test_rom(rom, size);
+  free(rom);
+  assert(path);
+
+  cartridge_t *cart = cartridge_new(path, save_file, policy);
+  unlink(path);
+  free(path);
+  assert(cart);
+  return cart;
+}
+
+static cartridge_t *insert_cartridge(uint8_t type, uint8_t rom_size,
+                                     uint8_t ram_size) {
+  return insert_game(type, rom_size, ram_size, 0, 0);
+}
+
+static uint8_t cart_read(cartridge_t *cart, gb_address_t address) {
+  mem_handler_t *handler = cartridge_get_memory_handler(cart);
+  return handler->read(handler, address);
+}
+
+static void cart_write(cartridge_t *cart, gb_address_t address,
+                       uint8_t value) {
+  mem_handler_t *handler = cartridge_get_memory_handler(cart);
+  handler->write(handler, address, value);
+}
+
+/* the number of the bank mapped to 0x4000 - 0x7FFF */
+static uint16_t switched_bank(cartridge_t *cart) {
+  return (uint16_t) (cart_read(cart, 0x4000) | cart_read(cart, 0x4001) << 8);
+}
+
+/* the mbc5 selects 512 banks with 9 bits, bank 0 included */
+TEST(test_mbc5_rom_banks,
+  cartridge_t *cart = insert_cartridge(0x19, 8, 0);
+  assert(switched_bank(cart) == 1);
+
+  cart_write(cart, 0x2000, 0x34);
+  assert(switched_bank(cart) == 0x34);
+  cart_write(cart, 0x3000, 0x01);
+  assert(switched_bank(cart) == 0x134);
+  cart_write(cart, 0x2FFF, 0xFF);
+  assert(switched_bank(cart) == 0x1FF);
+  cart_write(cart, 0x3000, 0x00);
+  assert(switched_bank(cart) == 0xFF);
+
+  cart_write(cart, 0x2000, 0x00);
+  assert(switched_bank(cart) == 0);
+  assert(cart_read(cart, 0x0000) == 0);
+
+  cartridge_delete(cart);
+)
+
+/* bit 3 of the ram bank drives the motor of rumble carts */
+TEST(test_mbc5_rumble_ram_bank,
+  cartridge_t *cart = insert_cartridge(0x1E, 0, 4);
+  cart_write(cart, 0x0000, 0x0A);
+
+  cart_write(cart, 0x4000, 0x01);
+  cart_write(cart, 0xA000, 0x11);
+  cart_write(cart, 0x4000, 0x09);
+  assert(cart_read(cart, 0xA000) == 0x11);
+  cart_write(cart, 0x4000, 0x00);
+  assert(cart_read(cart, 0xA000) == 0x00);
+
+  cartridge_delete(cart);
+
+  /* without a motor the bit selects the upper 8 banks */
+  cart = insert_cartridge(0x1B, 0, 4);
+  cart_write(cart, 0x0000, 0x0A);
+
+  cart_write(cart, 0x4000, 0x01);
+  cart_write(cart, 0xA000, 0x11);
+  cart_write(cart, 0x4000, 0x09);
+  cart_write(cart, 0xA000, 0x99);
+  cart_write(cart, 0x4000, 0x01);
+  assert(cart_read(cart, 0xA000) == 0x11);
+
+  cartridge_delete(cart);
+)
+
+/* 512 half bytes, repeated all over 0xA000 - 0xBFFF */
+TEST(test_mbc2_ram,
+  cartridge_t *cart = insert_cartridge(0x06, 1, 0);
+  cart_write(cart, 0x0000, 0x0A);
+
+  cart_write(cart, 0xA000, 0x05);
+  cart_write(cart, 0xA1FF, 0xAB);
+  for (gb_address_t address = 0xA000; address < 0xC000; address += 0x200) {
+    assert(cart_read(cart, address) == 0xF5);
+    assert(cart_read(cart, address + 0x1FF) == 0xFB);
+  }
+
+  /* writing a mirror writes all of them */
+  cart_write(cart, 0xBE00, 0x03);
+  assert(cart_read(cart, 0xA000) == 0xF3);
+  assert(cart_read(cart, 0xB000) == 0xF3);
+
+  /* code in one copy could not notice writes to another one */
+  assert(!cartridge_get_ram_window(cart));
+
+  cart_write(cart, 0x0000, 0x00);
+  assert(cart_read(cart, 0xA000) == 0xFF);
+
+  cartridge_delete(cart);
+)
+
+/* bit 8 of the address selects between ram enable and the rom bank */
+TEST(test_mbc2_rom_banks,
+  cartridge_t *cart = insert_cartridge(0x05, 3, 0);
+
+  cart_write(cart, 0x2100, 0x0F);
+  assert(switched_bank(cart) == 0x0F);
+  cart_write(cart, 0x0100, 0x00);
+  assert(switched_bank(cart) == 1);
+  cart_write(cart, 0x2000, 0x05);
+  assert(switched_bank(cart) == 1);
+
+  cartridge_delete(cart);
+)
+
+/* an mbc3 without a clock has no clock registers to select */
+TEST(test_mbc3_without_rtc,
+  cartridge_t *cart = insert_cartridge(0x13, 0, 3);
+  cart_write(cart, 0x0000, 0x0A);
+
+  cart_write(cart, 0x4000, 0x08);
+  cart_write(cart, 0xA000, 0x12);
+  assert(cart_read(cart, 0xA000) == 0x12);
+  cart_write(cart, 0x4000, 0x00);
+  assert(cart_read(cart, 0xA000) == 0x12);
+
+  cartridge_delete(cart);
+)
+
+/* clock registers, selected with 0x08 - 0x0C like ram banks */
+enum { RTC_S, RTC_M, RTC_H, RTC_DL, RTC_DH };
+
+static void rtc_set(cartridge_t *cart, int reg, uint8_t value) {
+  cart_write(cart, 0x4000, (uint8_t) (0x08 + reg));
+  cart_write(cart, 0xA000, value);
+}
+
+static uint8_t rtc_get(cartridge_t *cart, int reg) {
+  cart_write(cart, 0x4000, (uint8_t) (0x08 + reg));
+  return cart_read(cart, 0xA000);
+}
+
+static void rtc_latch(cartridge_t *cart) {
+  cart_write(cart, 0x6000, 0x00);
+  cart_write(cart, 0x6000, 0x01);
+}
+
+/* an mbc3 with a clock, ticking with 'cycles' */
+static cartridge_t *insert_clock_cartridge(const uint64_t *cycles,
+                                           const char *save_file) {
+  cartridge_t *cart = insert_game(0x10, 0, 3, save_file, 0);
+  cartridge_set_clock(cart, cycles);
+  cart_write(cart, 0x0000, 0x0A);
+  return cart;
+}
+
+/* the game reads the registers as they were at the last latch */
+TEST(test_rtc_latch,
+  uint64_t cycles = 0;
+  cartridge_t *cart = insert_clock_cartridge(&cycles, 0);
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_S) == 0);
+
+  cycles += 3 * CLOCK_SPEED - 1;
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_S) == 2);
+
+  cycles += 10 * CLOCK_SPEED;
+  assert(rtc_get(cart, RTC_S) == 2);
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_S) == 12);
+
+  cartridge_delete(cart);
+)
+
+TEST(test_rtc_carry,
+  uint64_t cycles = 0;
+  cartridge_t *cart = insert_clock_cartridge(&cycles, 0);
+  rtc_set(cart, RTC_S, 59);
+  rtc_set(cart, RTC_M, 59);
+  rtc_set(cart, RTC_H, 23);
+  rtc_set(cart, RTC_DL, 0xFF);
+
+  cycles += CLOCK_SPEED;
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_S) == 0);
+  assert(rtc_get(cart, RTC_M) == 0);
+  assert(rtc_get(cart, RTC_H) == 0);
+  assert(rtc_get(cart, RTC_DL) == 0);
+  assert(rtc_get(cart, RTC_DH) == 0x01);
+
+  cycles += (uint64_t) (61 * 60 + 1) * CLOCK_SPEED;
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_S) == 1);
+  assert(rtc_get(cart, RTC_M) == 1);
+  assert(rtc_get(cart, RTC_H) == 1);
+  assert(rtc_get(cart, RTC_DH) == 0x01);
+
+  cartridge_delete(cart);
+)
+
+/* bit 6 of the upper day register stops the clock */
+TEST(test_rtc_halt,
+  uint64_t cycles = 0;
+  cartridge_t *cart = insert_clock_cartridge(&cycles, 0);
+  rtc_set(cart, RTC_DH, 0x40);
+
+  cycles += 5 * CLOCK_SPEED;
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_S) == 0);
+  assert(rtc_get(cart, RTC_DH) == 0x40);
+
+  rtc_set(cart, RTC_DH, 0x00);
+  cycles += CLOCK_SPEED;
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_S) == 1);
+
+  cartridge_delete(cart);
+)
+
+/* the day counter has 9 bits, the carry stays set until it is cleared */
+TEST(test_rtc_day_carry,
+  uint64_t cycles = 0;
+  cartridge_t *cart = insert_clock_cartridge(&cycles, 0);
+
+  cycles += 511ull * 24 * 60 * 60 * CLOCK_SPEED;
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_DL) == 0xFF);
+  assert(rtc_get(cart, RTC_DH) == 0x01);
+
+  cycles += 24ull * 60 * 60 * CLOCK_SPEED;
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_DL) == 0x00);
+  assert(rtc_get(cart, RTC_DH) == 0x80);
+
+  cycles += 24ull * 60 * 60 * CLOCK_SPEED;
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_DL) == 0x01);
+  assert(rtc_get(cart, RTC_DH) == 0x80);
+
+  rtc_set(cart, RTC_DH, 0x00);
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_DH) == 0x00);
+
+  cartridge_delete(cart);
+)
+
+/* writing the seconds restarts the current second */
+TEST(test_rtc_seconds_write,
+  uint64_t cycles = 0;
+  cartridge_t *cart = insert_clock_cartridge(&cycles, 0);
+
+  cycles += CLOCK_SPEED - 1;
+  rtc_set(cart, RTC_S, 30);
+  cycles += CLOCK_SPEED - 1;
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_S) == 30);
+
+  cycles += 1;
+  rtc_latch(cart);
+  assert(rtc_get(cart, RTC_S) == 31);
+
+  cartridge_delete(cart);
+)
+
+/*
+ * Writes a save of an mbc3 with 32 KiB of ram, followed by the clock
+ * saved an hour ago. Older saves end with a 32 bit time.
+ */
+static void write_clock_save(const char *save_file, size_t rtc_size) {
+  uint8_t save[0x8000 + 48] = {0};
+  uint8_t *rtc = save + 0x8000;
+  const uint8_t registers[] = {10, 20, 3, 5, 0x01};
+  for (int i = 0; i < 5; ++i) {
+    rtc[4 * i] = registers[i];
+    rtc[20 + 4 * i] = (uint8_t) (registers[i] + 1);
+  }
+
+  /* a 44 byte clock keeps only the lower half of the time */
+  uint64_t saved = (uint64_t) time(NULL) - 60 * 60;
+  for (int i = 0; i < 8; ++i)
+    rtc[40 + i] = (uint8_t) (saved >> (8 * i));
+
+  FILE *file = fopen(save_file, "w");
+  assert(file);
+  assert(fwrite(save, 0x8000 + rtc_size, 1, file) == 1);
+  fclose(file);
+}
+
+/* the clock is loaded from the save and catches up with the time since */
+TEST(test_rtc_load,
+  char save_file[] = "/tmp/mage-test-XXXXXX";
+  int fd = mkstemp(save_file);
+  assert(fd >= 0);
+  close(fd);
+
+  for (size_t rtc_size = 44; rtc_size <= 48; rtc_size += 4) {
+    write_clock_save(save_file, rtc_size);
+    uint64_t cycles = 0;
+    cartridge_t *cart = insert_clock_cartridge(&cycles, save_file);
+
+    /* the latched registers as saved */
+    assert(rtc_get(cart, RTC_S) == 11);
+    assert(rtc_get(cart, RTC_H) == 4);
+    assert(rtc_get(cart, RTC_DH) == 0x02);
+
+    /* the registers an hour later */
+    rtc_latch(cart);
+    assert(rtc_get(cart, RTC_S) >= 10 && rtc_get(cart, RTC_S) <= 12);
+    assert(rtc_get(cart, RTC_M) == 20);
+    assert(rtc_get(cart, RTC_H) == 4);
+    assert(rtc_get(cart, RTC_DL) == 5);
+    assert(rtc_get(cart, RTC_DH) == 0x01);
+
+    cartridge_delete(cart);
+  }
+
+  unlink(save_file);
+)
+
+/* a new name for a save file that does not exist yet */
+static char *new_save_file(void) {
+  char *save_file = strdup("/tmp/mage-test-XXXXXX");
+  int fd = mkstemp(save_file);
+  assert(fd >= 0);
+  close(fd);
+  unlink(save_file);
+  return save_file;
+}
+
+/* games without ram do not write a save file */
+TEST(test_no_save_file_without_ram,
+  char *save_file = new_save_file();
+  cartridge_t *cart = insert_game(0x00, 0, 0, save_file, 0);
+  cartridge_delete(cart);
+  assert(access(save_file, F_OK) != 0);
+  free(save_file);
+)
+
+/* Returns the first byte of the save file, or -1 if there is none yet. */
+static int first_saved_byte(const char *save_file) {
+  FILE *file = fopen(save_file, "r");
+  if (!file) return -1;
+  int value = fgetc(file);
+  fclose(file);
+  return value;
+}
+
+/* waits for the thread of the save game to write 'value' */
+static void wait_for_save(const char *save_file, int value) {
+  for (int i = 0; i < 500 && first_saved_byte(save_file) != value; ++i)
+    usleep(10 * 1000);
+  assert(first_saved_byte(save_file) == value);
+}
+
+static void end_frames(cartridge_t *cart, int frames) {
+  for (int i = 0; i < frames; ++i)
+    cartridge_end_frame(cart);
+}
+
+/* the ram is saved once the game stopped writing it, or writes for long */
+TEST(test_save_game_written_in_background,
+  char *save_file = new_save_file();
+  uint64_t cycles = 0;
+  cartridge_t *cart = insert_clock_cartridge(&cycles, save_file);
+
+  /* the frame of the write and 60 quiet ones */
+  cart_write(cart, 0x4000, 0x00);
+  cart_write(cart, 0xA000, 0x42);
+  end_frames(cart, 60);
+  assert(first_saved_byte(save_file) == -1);
+  end_frames(cart, 1);
+  wait_for_save(save_file, 0x42);
+
+  /* the ram and the clock, written atomically */
+  struct stat save_stat;
+  assert(stat(save_file, &save_stat) == 0);
+  assert(save_stat.st_size == 0x8000 + 48);
+  char *temp_file = malloc(strlen(save_file) + 5);
+  sprintf(temp_file, "%s.tmp", save_file);
+  assert(access(temp_file, F_OK) != 0);
+
+  /* 600 frames of writes */
+  for (int i = 0; i < 599; ++i) {
+    cart_write(cart, 0xA000, 0x44);
+    cartridge_end_frame(cart);
+  }
+  usleep(50 * 1000);
+  assert(first_saved_byte(save_file) == 0x42);
+  cart_write(cart, 0xA000, 0x44);
+  cartridge_end_frame(cart);
+  wait_for_save(save_file, 0x44);
+
+  /* deleting the cartridge waits for the last save */
+  cart_write(cart, 0xA000, 0x43);
+  cartridge_end_frame(cart);
+  cartridge_delete(cart);
+  assert(first_saved_byte(save_file) == 0x43);
+
+  unlink(save_file);
+  free(temp_file);
+  free(save_file);
+)
+
+static size_t file_size(const char *file_name) {
+  struct stat file_stat;
+  assert(stat(file_name, &file_stat) == 0);
+  return (size_t) file_stat.st_size;
+}
+
+/* the game writes the mapped save file directly */
+TEST(test_mapped_save_file,
+  char *save_file = new_save_file();
+  save_policy_t policy = {.mapped = true};
+  cartridge_t *cart = insert_game(0x10, 0, 3, save_file, &policy);
+
+  /* the ram of mbc3 carts is followed by the clock */
+  assert(file_size(save_file) == 0x8000 + 48);
+
+  cart_write(cart, 0x0000, 0x0A);
+  cart_write(cart, 0x4000, 0x00);
+  cart_write(cart, 0xA000, 0x42);
+  assert(first_saved_byte(save_file) == 0x42);
+  cartridge_delete(cart);
+
+  /* a shorter file is extended and the ram is loaded from it */
+  FILE *file = fopen(save_file, "w");
+  fputc(0x24, file);
+  fclose(file);
+  cart = insert_game(0x10, 0, 3, save_file, &policy);
+  assert(file_size(save_file) == 0x8000 + 48);
+  cart_write(cart, 0x0000, 0x0A);
+  cart_write(cart, 0x4000, 0x00);
+  assert(cart_read(cart, 0xA000) == 0x24);
+  cartridge_delete(cart);
+
+  unlink(save_file);
+  free(save_file);
+)
+
+/* the mbc2 and rams smaller than a bank are saved as a copy */
+TEST(test_mapped_save_file_fallback,
+  save_policy_t policy = {.mapped = true};
+  const uint8_t types[] = {0x06, 0x03};
+  const uint8_t ram_sizes[] = {0, 1};
+  const size_t saved_sizes[] = {0x200, 0x800};
+
+  for (int i = 0; i < 2; ++i) {
+    char *save_file = new_save_file();
+    cartridge_t *cart =
+        insert_game(types[i], 0, ram_sizes[i], save_file, &policy);
+
+    cart_write(cart, 0x0000, 0x0A);
+    cart_write(cart, 0xA000, 0x02);
+    assert(first_saved_byte(save_file) == -1);
+    cartridge_delete(cart);
+
+    assert(file_size(save_file) == saved_sizes[i]);
+    assert((first_saved_byte(save_file) & 0xF) == 0x02);
+
+    unlink(save_file);
+    free(save_file);
+  }
+)
@@ -1,11 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "testing.h"
 #include "src/memory/mmu.h"
+#include "src/video/ppu.h"
 
 #include "src/memory/memory_handler.h"
+#include "src/logging.h"
 
 void die(const char *s) {
   fputs(s, stderr);
@@ -16,6 +19,20 @@ void run(cpu_t *cpu) {
   while (cpu_read(cpu, cpu->pc) != 0x00) update_cpu_state(cpu, NULL);
 }
 
+char *write_test_rom(const uint8_t *rom, size_t size) {
+  char path[] = "/tmp/mage-test-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) return 0;
+
+  bool written = write(fd, rom, size) == (ssize_t) size;
+  close(fd);
+  if (!written) {
+    unlink(path);
+    return 0;
+  }
+  return strdup(path);
+}
+
 static uint8_t memory[0xC000];
 static mem_handler_t test_mem_handler;
 
@@ -34,18 +51,18 @@ void test_mem_handler_init(void) {
 
 static void setup_memory_mapping(mmu_t *mmu) {
   test_mem_handler_init();
-  mmu_register_mem_handler(mmu, &test_mem_handler, AS_HANDLE_ROM);
-  mmu_register_mem_handler(mmu, &test_mem_handler, AS_HANDLE_EXT);
-  mmu_register_mem_handler(mmu, &test_mem_handler, AS_HANDLE_VIDEO);
+  mmu_assign_rom_handler(mmu, &test_mem_handler);
+  mmu_assign_extram_handler(mmu, &test_mem_handler);
+  mmu_assign_vram_handler(mmu, &test_mem_handler);
 }
 
+/* the cpu right after cpu_init, every test starts from it */
+static cpu_t initial_cpu;
+
 static void clean(cpu_t *cpu) {
-  mmu_t *mmu = cpu->mmu;
-  ppu_t *lcd = cpu->ppu;
-  memset(cpu, 0, sizeof(cpu_t));
-  cpu->mmu = mmu;
+  *cpu = initial_cpu;
   mmu_clean(cpu->mmu);
-  cpu->ppu = lcd;
+  block_cache_flush(cpu->block_cache);
 }
 
 static void do_test(test_t test, cpu_t *cpu) {
@@ -63,12 +80,14 @@ extern void (*__testing_array_start[]) (cpu_t *);
 extern void (*__testing_array_end[]) (cpu_t *);
 
 int main(void) {
+  logging_initialize();
   memset(memory, 0, sizeof(memory));
   mmu_t *mmu = mmu_new();
   cpu_t *cpu = calloc(1, sizeof(cpu_t));
   ppu_t *ppu = ppu_new(mmu, cpu, memory + 0x8000, NULL);
   cpu_init(cpu, mmu, ppu);
   setup_memory_mapping(mmu);
+  initial_cpu = *cpu;
 
   const size_t size = __testing_array_end - __testing_array_start;
   for (size_t i = 0; i < size; ++i)
@@ -1,4 +1,6 @@
 #pragma once
+/* the tests are asserts, they have to run in release builds as well */
+#undef NDEBUG
 #include <src/cpu/cpu.h>
 #include <assert.h>
 #include <stdio.h>
@@ -20,3 +22,8 @@ typedef void (*test_t)(cpu_t *cpu);
 /* runs the cpu until a NOP was encountered */
 void run(cpu_t *cpu);
 
+/*
+ * Writes the rom to a new temporary file, since games are loaded from
+ * files. Returns the name of the file, which the caller frees, or NULL.
+ */
+char *write_test_rom(const uint8_t *rom, size_t size);
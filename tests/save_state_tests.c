@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "driver/testing.h"
+#include "src/gameboy.h"
+#include "src/input/null_input.h"
+
+/* An MBC1 rom with ram that keeps counting in work ram and cartridge ram. */
+static char *write_counting_rom(uint8_t global_checksum) {
+  static const uint8_t program[] = {
+      0x31, 0xFE, 0xDF,   /* 0150  LD SP, 0xDFFE */
+      0x3E, 0x0A,         /* 0153  LD A, 0x0A */
+      0xEA, 0x00, 0x00,   /* 0155  LD (0x0000), A  ; enable the ram */
+      0x21, 0x00, 0xC0,   /* 0158  LD HL, 0xC000   ; loop */
+      0x34,               /* 015B  INC (HL)        ; count */
+      0x7E,               /* 015C  LD A, (HL) */
+      0xEA, 0x00, 0xA0,   /* 015D  LD (0xA000), A */
+      0x2C,               /* 0160  INC L */
+      0x20, 0xF8,         /* 0161  JR NZ, count */
+      0x18, 0xF3,         /* 0163  JR loop */
+  };
+
+  uint8_t *rom = calloc(1, 0x8000);
+  static const uint8_t entry[] = {0x00, 0xC3, 0x50, 0x01};
+  memcpy(rom + 0x100, entry, sizeof(entry));
+  memcpy(rom + 0x150, program, sizeof(program));
+  rom[0x147] = 0x03;
+  rom[0x149] = 0x02;
+  rom[0x14F] = global_checksum;
+
+  char *path = write_test_rom(rom, 0x8000);
+  free(rom);
+  return path;
+}
+
+static gb_t game_boy_with_rom(const char *path) {
+  gb_t gb = game_boy_new(0, 0, null_joy_pad_new());
+  game_boy_insert_game(gb, path, 0);
+  return gb;
+}
+
+/* saving, running on and loading again has to replay exactly */
+TEST(test_save_state_round_trip,
+  char *path = write_counting_rom(0);
+  gb_t gb = game_boy_with_rom(path);
+  game_boy_run_frames(gb, 10);
+
+  size_t size = game_boy_state_size(gb);
+  uint8_t *saved = malloc(size), *ran_on = malloc(size), *replayed =
+      malloc(size);
+  assert(game_boy_save_state(gb, saved, size));
+  assert(!game_boy_save_state(gb, saved, size - 1));
+
+  game_boy_run_frames(gb, 10);
+  assert(game_boy_save_state(gb, ran_on, size));
+
+  assert(game_boy_load_state(gb, saved, size));
+  game_boy_run_frames(gb, 10);
+  assert(game_boy_save_state(gb, replayed, size));
+  assert(memcmp(ran_on, replayed, size) == 0);
+
+  game_boy_delete(gb);
+  unlink(path);
+  free(path);
+  free(saved);
+  free(ran_on);
+  free(replayed);
+)
+
+/* a state of another game or a corrupted one changes nothing */
+TEST(test_save_state_rejected,
+  char *path = write_counting_rom(0);
+  char *other_path = write_counting_rom(1);
+  gb_t gb = game_boy_with_rom(path);
+  gb_t other = game_boy_with_rom(other_path);
+  game_boy_run_frames(gb, 5);
+  game_boy_run_frames(other, 3);
+
+  size_t size = game_boy_state_size(gb);
+  assert(size == game_boy_state_size(other));
+  uint8_t *state = malloc(size), *before = malloc(size), *after =
+      malloc(size);
+  assert(game_boy_save_state(gb, state, size));
+  assert(game_boy_save_state(other, before, size));
+
+  assert(!game_boy_load_state(other, state, size));
+  assert(!game_boy_load_state(other, state, size - 1));
+  state[0] ^= 0xFF;
+  assert(!game_boy_load_state(gb, state, size));
+
+  assert(game_boy_save_state(other, after, size));
+  assert(memcmp(before, after, size) == 0);
+
+  game_boy_delete(gb);
+  game_boy_delete(other);
+  unlink(path);
+  unlink(other_path);
+  free(path);
+  free(other_path);
+  free(state);
+  free(before);
+  free(after);
+)
+
+/* rewinding goes back to the states saved after every frame */
+TEST(test_save_state_rewind,
+  char *path = write_counting_rom(0);
+  gb_t gb = game_boy_with_rom(path);
+  assert(game_boy_set_rewind(gb, 1 << 20));
+  game_boy_run_frames(gb, 10);
+
+  size_t size = game_boy_state_size(gb);
+  uint8_t *saved = malloc(size), *rewound = malloc(size);
+  assert(game_boy_save_state(gb, saved, size));
+
+  game_boy_run_frames(gb, 10);
+  assert(game_boy_rewind(gb, 10) == 10);
+  assert(game_boy_save_state(gb, rewound, size));
+  assert(memcmp(saved, rewound, size) == 0);
+
+  game_boy_delete(gb);
+  unlink(path);
+  free(path);
+  free(saved);
+  free(rewound);
+)